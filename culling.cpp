@@ -0,0 +1,210 @@
+#include <math.h>
+#include <algorithm>
+
+#include "culling.h"
+
+
+Vector3Float cellCorner(Vector3Int index, int cellBounds) {
+    // The cube of a cell is centered on index - (cellBounds - 1) / 2, so its low corner is half a cell before that
+    return { index.x - cellBounds / 2.0f, index.y - cellBounds / 2.0f, index.z - cellBounds / 2.0f };
+}
+
+Frustum makeFrustum(const ViewCamera &camera) {
+    // Same view as Raylib's BeginMode3D: looking from position at target, fovy high and fovy * aspect wide
+    Vector3Float forward = normalize(camera.target - camera.position);
+    Vector3Float right = normalize(cross(forward, camera.up));
+    Vector3Float up = cross(right, forward);
+    float tanY = tan(camera.fovy * 3.14159265358979323846f / 360.0f);
+    float tanX = tanY * camera.aspect;
+
+    Frustum frustum;
+    Vector3Float normals[6] = {
+        forward, // near
+        forward * -1.0f, // far
+        forward * tanX + right, // left (leaning in by the half angle)
+        forward * tanX - right, // right
+        forward * tanY + up, // bottom
+        forward * tanY - up // top
+    };
+    for (int i = 0; i < 6; i++) {
+        frustum.normals[i] = normals[i];
+        frustum.distances[i] = -dot(normals[i], camera.position); // the sides go through the camera
+    }
+    frustum.distances[0] -= CULL_NEAR;
+    frustum.distances[1] += CULL_FAR;
+    return frustum;
+}
+
+bool boxOutside(const Frustum &frustum, Vector3Float min, Vector3Float max) {
+    // The corner that is the furthest along a plane's normal is the last one to leave it
+    for (int i = 0; i < 6; i++) {
+        const Vector3Float &normal = frustum.normals[i];
+        Vector3Float furthest = {
+            normal.x >= 0 ? max.x : min.x,
+            normal.y >= 0 ? max.y : min.y,
+            normal.z >= 0 ? max.z : min.z
+        };
+        if (dot(normal, furthest) + frustum.distances[i] < 0) return true;
+    }
+    return false;
+}
+
+void planeRange(const ClipPlane &plane, const CellBox &cells, float &low, float &high) {
+    // Like boxOutside(), the corner the furthest along the normal and the one the furthest against it
+    const Vector3Float &normal = plane.normal;
+    Vector3Int last = { cells.max.x - 1, cells.max.y - 1, cells.max.z - 1 };
+    low = planeDistance(plane, { normal.x >= 0 ? cells.min.x : last.x, normal.y >= 0 ? cells.min.y : last.y, normal.z >= 0 ? cells.min.z : last.z });
+    high = planeDistance(plane, { normal.x >= 0 ? last.x : cells.min.x, normal.y >= 0 ? last.y : cells.min.y, normal.z >= 0 ? last.z : cells.min.z });
+}
+
+ChunkGrid makeChunkGrid(int cellBounds, const CellBox &box, const vector<ClipPlane> &planes) {
+    ChunkGrid grid;
+    grid.cellBounds = cellBounds;
+    grid.chunksPerEdge = (cellBounds + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    grid.box = box;
+    grid.planes = planes;
+    const int chunks = grid.chunksPerEdge;
+    grid.drawn.assign((size_t)chunks * chunks * chunks, 0);
+    grid.clip.assign(grid.drawn.size(), CHUNK_WHOLE);
+    for (size_t i = 0; i < grid.clip.size(); i++) {
+        int x = (int)i / (chunks * chunks), y = (int)i / chunks % chunks, z = (int)i % chunks;
+        CellBox part = chunkCells(grid, (int)i);
+        if (part.min.x == part.max.x || part.min.y == part.max.y || part.min.z == part.max.z) {
+            grid.clip[i] = CHUNK_OUTSIDE;
+            continue;
+        }
+        bool whole = part.min.x == x * CHUNK_SIZE && part.max.x == std::min((x + 1) * CHUNK_SIZE, cellBounds) &&
+            part.min.y == y * CHUNK_SIZE && part.max.y == std::min((y + 1) * CHUNK_SIZE, cellBounds) &&
+            part.min.z == z * CHUNK_SIZE && part.max.z == std::min((z + 1) * CHUNK_SIZE, cellBounds);
+        grid.clip[i] = whole ? CHUNK_WHOLE : CHUNK_CUT;
+        for (const ClipPlane &plane : planes) {
+            float low, high;
+            planeRange(plane, part, low, high);
+            if (high < 0) {
+                grid.clip[i] = CHUNK_OUTSIDE;
+                break;
+            }
+            if (low < 0) grid.clip[i] = CHUNK_CUT;
+        }
+    }
+    return grid;
+}
+
+bool cellInside(const ChunkGrid &grid, Vector3Int index) {
+    const CellBox &box = grid.box;
+    if (index.x < box.min.x || index.x >= box.max.x || index.y < box.min.y || index.y >= box.max.y ||
+        index.z < box.min.z || index.z >= box.max.z) return false;
+    for (const ClipPlane &plane : grid.planes) {
+        if (planeDistance(plane, index) < 0) return false;
+    }
+    return true;
+}
+
+ChunkGrid countChunks(const CellVector &cells, int cellBounds, const CellBox &box, const vector<ClipPlane> &planes) {
+    ChunkGrid grid = makeChunkGrid(cellBounds, box, planes);
+    for (size_t i = 0; i < grid.drawn.size(); i++) {
+        if (grid.clip[i] == CHUNK_OUTSIDE) continue;
+        bool whole = grid.clip[i] == CHUNK_WHOLE;
+        CellBox part = chunkCells(grid, (int)i);
+        int drawn = 0;
+        for (int x = part.min.x; x < part.max.x; x++) {
+            for (int y = part.min.y; y < part.max.y; y++) {
+                for (int z = part.min.z; z < part.max.z; z++) {
+                    if (cells[threeToOne(x, y, z, cellBounds)].getHp() < 0) continue;
+                    drawn += whole || cellInside(grid, { x, y, z });
+                }
+            }
+        }
+        grid.drawn[i] = drawn;
+    }
+    findSolidChunks(grid);
+    return grid;
+}
+
+void findSolidChunks(ChunkGrid &grid) {
+    grid.solid.assign(grid.drawn.size(), false);
+    for (size_t i = 0; i < grid.drawn.size(); i++) {
+        // Only a chunk that the box and planes don't cut into is solid, otherwise part of it isn't drawn
+        CellBox part = chunkCells(grid, (int)i);
+        int volume = (part.max.x - part.min.x) * (part.max.y - part.min.y) * (part.max.z - part.min.z);
+        grid.solid[i] = chunkWhole(grid, (int)i) && grid.drawn[i] == volume;
+    }
+}
+
+CellBox chunkCells(const ChunkGrid &grid, int chunk) {
+    const int chunks = grid.chunksPerEdge;
+    int x = chunk / (chunks * chunks), y = chunk / chunks % chunks, z = chunk % chunks;
+    CellBox part;
+    part.min = {
+        std::max(x * CHUNK_SIZE, grid.box.min.x),
+        std::max(y * CHUNK_SIZE, grid.box.min.y),
+        std::max(z * CHUNK_SIZE, grid.box.min.z)
+    };
+    part.max = {
+        std::max(part.min.x, std::min((x + 1) * CHUNK_SIZE, grid.box.max.x)),
+        std::max(part.min.y, std::min((y + 1) * CHUNK_SIZE, grid.box.max.y)),
+        std::max(part.min.z, std::min((z + 1) * CHUNK_SIZE, grid.box.max.z))
+    };
+    return part;
+}
+
+bool chunkWhole(const ChunkGrid &grid, int chunk) {
+    return grid.clip[chunk] == CHUNK_WHOLE;
+}
+
+vector<int> visibleChunks(const ChunkGrid &grid, const ViewCamera &camera, CullStats &stats) {
+    Frustum frustum = makeFrustum(camera);
+    const int chunks = grid.chunksPerEdge;
+    // The cubes are only drawn from the outside (backface culling), so the chunk the camera is in hides nothing
+    const Vector3Float &eye = camera.position;
+    Vector3Float origin = cellCorner({ 0, 0, 0 }, grid.cellBounds);
+    Vector3Int eyeChunk = {
+        (int)floor((eye.x - origin.x) / CHUNK_SIZE),
+        (int)floor((eye.y - origin.y) / CHUNK_SIZE),
+        (int)floor((eye.z - origin.z) / CHUNK_SIZE)
+    };
+    auto solid = [&](int x, int y, int z) {
+        if (x < 0 || y < 0 || z < 0 || x >= chunks || y >= chunks || z >= chunks) return false;
+        if (x == eyeChunk.x && y == eyeChunk.y && z == eyeChunk.z) return false;
+        return (bool)grid.solid[threeToOne(x, y, z, chunks)];
+    };
+
+    vector<int> visible;
+    for (int x = 0; x < chunks; x++) {
+        for (int y = 0; y < chunks; y++) {
+            for (int z = 0; z < chunks; z++) {
+                size_t i = threeToOne(x, y, z, chunks);
+                if (grid.drawn[i] == 0) continue;
+                stats.chunks++;
+                CellBox part = chunkCells(grid, (int)i);
+                Vector3Float min = cellCorner(part.min, grid.cellBounds);
+                Vector3Float max = cellCorner(part.max, grid.cellBounds);
+                if (boxOutside(frustum, min, max)) {
+                    stats.frustumCulled++;
+                    continue;
+                }
+
+                // A ray from the camera to anything in the chunk comes in through a face that faces the camera,
+                // right after going through the neighbor on the other side of it. So when all of those neighbors
+                // are solid, every ray hits a cell before it gets here (when the camera is inside the chunk's
+                // extent on every axis, no face faces it and it is always drawn)
+                int facing[3] = {
+                    eye.x < min.x ? -1 : (eye.x > max.x ? 1 : 0),
+                    eye.y < min.y ? -1 : (eye.y > max.y ? 1 : 0),
+                    eye.z < min.z ? -1 : (eye.z > max.z ? 1 : 0)
+                };
+                bool hidden = facing[0] != 0 || facing[1] != 0 || facing[2] != 0;
+                if (facing[0] != 0) hidden = hidden && solid(x + facing[0], y, z);
+                if (facing[1] != 0) hidden = hidden && solid(x, y + facing[1], z);
+                if (facing[2] != 0) hidden = hidden && solid(x, y, z + facing[2]);
+                if (hidden) {
+                    stats.occluded++;
+                    continue;
+                }
+                visible.push_back((int)i);
+                stats.drawnCells += grid.drawn[i];
+            }
+        }
+    }
+    return visible;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <math.h>
+#include <vector>
+
+#include "simulation.h"
+
+using std::vector;
+
+
+#define CHUNK_SIZE 8
+// The same clipping distances as Raylib's BeginMode3D (RL_CULL_DISTANCE_NEAR/FAR)
+#define CULL_NEAR 0.01f
+#define CULL_FAR 1000.0f
+
+
+struct Vector3Float {
+    float x, y, z;
+};
+
+struct ViewCamera {
+    // What culling needs from a Camera3D (which is Raylib, so it is copied over in main.cpp)
+    Vector3Float position;
+    Vector3Float target;
+    Vector3Float up;
+    float fovy; // vertical, in degrees
+    float aspect; // width / height of what is drawn to
+};
+
+struct Frustum {
+    // A point p is inside when normal . p + distance >= 0 for all 6 planes
+    Vector3Float normals[6];
+    float distances[6];
+};
+
+struct CellBox {
+    // The cells that are drawn, min <= index < max on every axis
+    Vector3Int min;
+    Vector3Int max;
+};
+
+struct ClipPlane {
+    // In cell indexes: a cell is on the kept side when normal . index + distance >= 0 (the normal has a length of 1,
+    // so that is how many cells away from the plane it is)
+    Vector3Float normal;
+    float distance;
+};
+
+enum ChunkClip {
+    CHUNK_OUTSIDE = 0, // none of its cells are inside
+    CHUNK_CUT = 1, // the box or a plane cuts into it, so its cells have to be checked 1 at a time
+    CHUNK_WHOLE = 2
+};
+
+struct ChunkGrid {
+    // The cells split into CHUNK_SIZE^3 chunks, with how many cells of each are drawn (hp >= 0) inside the CellBox
+    // and on the kept side of every plane
+    int cellBounds;
+    int chunksPerEdge;
+    CellBox box;
+    vector<ClipPlane> planes;
+    vector<unsigned char> clip; // the ChunkClip of each chunk, from the box and planes alone
+    vector<int> drawn;
+    vector<bool> solid; // completely inside the box and every cell is drawn, so it hides whatever is behind it
+};
+
+struct CullStats {
+    size_t chunks = 0;
+    size_t frustumCulled = 0;
+    size_t occluded = 0;
+    size_t drawnCells = 0; // in the chunks that are left
+    size_t blocks = 0; // drawn instead of cells by the level of detail (see lod.h)
+    size_t blockCells = 0; // the drawn cells in those blocks
+    size_t sliceChunks = 0; // the chunks the slice plane goes through, the only ones looked at (see sliceInstances() in render.h)
+};
+
+inline Vector3Float operator+(Vector3Float a, Vector3Float b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+inline Vector3Float operator-(Vector3Float a, Vector3Float b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+inline Vector3Float operator*(Vector3Float a, float scale) { return { a.x * scale, a.y * scale, a.z * scale }; }
+inline float dot(Vector3Float a, Vector3Float b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vector3Float cross(Vector3Float a, Vector3Float b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+inline Vector3Float normalize(Vector3Float a) {
+    float length = sqrt(dot(a, a));
+    return length > 0 ? a * (1.0f / length) : a;
+}
+
+
+// Where cell index is drawn: the grid is centered on 0, 1 unit per cell (see drawCell() in main.cpp)
+Vector3Float cellCorner(Vector3Int index, int cellBounds);
+
+Frustum makeFrustum(const ViewCamera &camera);
+// Whether the box is completely outside of 1 of the planes (so some boxes that are outside still count as inside)
+bool boxOutside(const Frustum &frustum, Vector3Float min, Vector3Float max);
+
+inline float planeDistance(const ClipPlane &plane, Vector3Int index) {
+    return plane.normal.x * index.x + plane.normal.y * index.y + plane.normal.z * index.z + plane.distance;
+}
+// The lowest and highest planeDistance() of the cells in a box that isn't empty (at 2 of its corners)
+void planeRange(const ClipPlane &plane, const CellBox &cells, float &low, float &high);
+
+// The grid of the box and planes with which chunks they cut into, but nothing counted yet (every drawn is 0)
+ChunkGrid makeChunkGrid(int cellBounds, const CellBox &box, const vector<ClipPlane> &planes);
+// Whether a cell is inside the box and on the kept side of every plane
+bool cellInside(const ChunkGrid &grid, Vector3Int index);
+// Only the cells of the chunks the box and planes cut into are checked 1 at a time, the ones outside aren't gone over at all
+ChunkGrid countChunks(const CellVector &cells, int cellBounds, const CellBox &box, const vector<ClipPlane> &planes = {});
+// Fills in grid.solid from grid.drawn (for grids counted some other way, see render.h)
+void findSolidChunks(ChunkGrid &grid);
+// The cells of a chunk (an index into grid.drawn) that are inside the box
+CellBox chunkCells(const ChunkGrid &grid, int chunk);
+// Whether neither the box nor a plane cuts into the chunk (all of its cells are inside)
+bool chunkWhole(const ChunkGrid &grid, int chunk);
+
+// The chunks that can be seen (as indexes into grid.drawn): the ones that are inside the frustum and
+// aren't occluded, a chunk is occluded when the neighbor across every one of its faces that faces the camera is solid
+vector<int> visibleChunks(const ChunkGrid &grid, const ViewCamera &camera, CullStats &stats);
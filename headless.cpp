@@ -0,0 +1,1001 @@
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "culling.h"
+#include "headless.h"
+#include "instrumentation.h"
+#include "lod.h"
+#include "producer.h"
+#include "render.h"
+
+using std::thread;
+
+
+struct SweepResult {
+    string rule;
+    string outcome;
+    int ticks;
+    int computedTicks;
+    int period;
+    int cycleStart;
+    size_t finalAlive;
+    size_t finalDying;
+    size_t peakLive;
+    int peakTick;
+    bool reachedEdge;
+};
+
+bool liveCellOnEdge(const CellVector &cells, int bounds) {
+    int last = bounds - 1;
+    for (int a = 0; a < bounds; a++) {
+        for (int b = 0; b < bounds; b++) {
+            if (cells[threeToOne(0, a, b, bounds)].getHp() >= 0 || cells[threeToOne(last, a, b, bounds)].getHp() >= 0 ||
+                cells[threeToOne(a, 0, b, bounds)].getHp() >= 0 || cells[threeToOne(a, last, b, bounds)].getHp() >= 0 ||
+                cells[threeToOne(a, b, 0, bounds)].getHp() >= 0 || cells[threeToOne(a, b, last, bounds)].getHp() >= 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void classifyRun(SweepResult &result, const vector<TickStats> &history) {
+    // Repeated generations (found by their hashes) decide dies/stable/oscillates,
+    // otherwise the end of the population time series (alive and dying counts per tick) is used
+    // (a run that stopped on its first tick has fewer than 2 generations to compare)
+    size_t window = std::min<size_t>(std::min<size_t>(std::max<size_t>(history.size() / 4, 2), 50), history.size());
+    size_t first = history.size() - window;
+    const TickStats &last = history.back();
+
+    if (last.aliveCells + last.dyingCells == 0) {
+        result.outcome = "dies";
+        return;
+    }
+    if (result.period > 0) {
+        result.outcome = result.period == 1 ? "stable" : "oscillates";
+        return;
+    }
+    size_t startLive = history[first].aliveCells + history[first].dyingCells;
+    size_t endLive = last.aliveCells + last.dyingCells;
+    if (result.reachedEdge || endLive > startLive + startLive / 10) result.outcome = "grows"; // reachedEdge is only set with clip
+    else result.outcome = "chaotic";
+}
+
+SweepResult runSweepRule(const string &rule, Simulation &simulation, const CommandLine &command, const Options &options) {
+    RuleSet rules = parseRuleString(rule, options.simulation.rules.boundary, options.neighborhoodMask);
+    simulation.setRules(rules);
+    std::mt19937 rng(command.seed);
+    vector<TickStats> history;
+    history.reserve(command.ticks + 1);
+    history.push_back(simulation.randomize(rng));
+    const int bounds = simulation.getConfig().cellBounds;
+
+    SweepResult result;
+    result.rule = ruleToString(rules);
+    result.reachedEdge = false;
+    result.peakLive = history[0].aliveCells;
+    result.peakTick = 0;
+    result.period = 0;
+    result.cycleStart = 0;
+    for (int tick = 1; tick <= command.ticks; tick++) {
+        simulation.tick(1);
+        const TickStats stats = simulation.getStats();
+        history.push_back(stats);
+        size_t live = stats.aliveCells + stats.dyingCells;
+        if (live > result.peakLive) {
+            result.peakLive = live;
+            result.peakTick = tick;
+        }
+        // Only clip has an edge to reach, with wrap and mirror the cells on it are as much in the middle as any other
+        if (!result.reachedEdge && rules.boundary == CLIP) result.reachedEdge = liveCellOnEdge(simulation.getCells(), bounds);
+        // Once a generation repeats, every tick after it is already known
+        if (simulation.getPeriod() > 0) break;
+    }
+    result.computedTicks = history.size() - 1;
+    result.ticks = command.ticks;
+    result.period = simulation.getPeriod();
+    result.cycleStart = simulation.getCycleStart();
+
+    TickStats final = history.back();
+    if (result.period > 0) {
+        // Fast forward: tick T is the same generation as cycleStart + (T - cycleStart) % period
+        final = history[result.cycleStart + (command.ticks - result.cycleStart) % result.period];
+    }
+    result.finalAlive = final.aliveCells;
+    result.finalDying = final.dyingCells;
+    classifyRun(result, history);
+    return result;
+}
+
+void writeSweepReport(const vector<SweepResult> &results, std::ostream &out, bool asJSON, unsigned int seed, int cellBounds) {
+    if (asJSON) {
+        json report = json::array();
+        for (const SweepResult &result : results) {
+            report.push_back({
+                { "rule", result.rule },
+                { "outcome", result.outcome },
+                { "ticks", result.ticks },
+                { "computedTicks", result.computedTicks },
+                { "period", result.period },
+                { "cycleStart", result.cycleStart },
+                { "finalAlive", result.finalAlive },
+                { "finalDying", result.finalDying },
+                { "peakLive", result.peakLive },
+                { "peakTick", result.peakTick },
+                { "reachedEdge", result.reachedEdge },
+                { "seed", seed },
+                { "cellBounds", cellBounds }
+            });
+        }
+        out << report.dump(4) << std::endl;
+        return;
+    }
+    out << "rule,outcome,ticks,computedTicks,period,cycleStart,finalAlive,finalDying,peakLive,peakTick,reachedEdge,seed,cellBounds" << std::endl;
+    for (const SweepResult &result : results) {
+        out << result.rule << "," << result.outcome << "," << result.ticks << "," << result.computedTicks << "," <<
+            result.period << "," << result.cycleStart << "," <<
+            result.finalAlive << "," << result.finalDying << "," << result.peakLive << "," << result.peakTick << "," <<
+            (result.reachedEdge ? "true" : "false") << "," << seed << "," << cellBounds << std::endl;
+    }
+}
+
+void runSweep(const CommandLine &command, const Options &options) {
+    // Every rule gets the same starting grid (same seed), each worker thread owns 1 grid
+    // and keeps taking the next rule until there are none left
+    vector<string> rules;
+    const int cellBounds = options.simulation.cellBounds;
+    for (const string &rule : command.sweepRules) {
+        vector<string> expanded = expandRuleRanges(rule);
+        for (const string &single : expanded) {
+            // fail before starting rather than halfway through
+            if (parseRuleString(single, options.simulation.rules.boundary, options.neighborhoodMask).radius > cellBounds) {
+                throw std::out_of_range("the neighborhood of '" + single + "' reaches further than cellBounds");
+            }
+            rules.push_back(single);
+        }
+    }
+
+    vector<SweepResult> results(rules.size());
+    std::atomic<size_t> nextRule(0);
+    std::atomic<size_t> finished(0);
+    size_t workerCount = std::max<size_t>(1, std::min(options.simulation.threads, rules.size()));
+    std::cerr << "Sweeping " << rules.size() << " rules for " << command.ticks << " ticks on " << workerCount << " threads..." << std::endl;
+
+    vector<thread> workers;
+    for (size_t w = 0; w < workerCount; w++) {
+        workers.push_back(thread([&]() {
+            SimulationConfig config = options.simulation;
+            config.threads = 1;
+            Simulation simulation(config); // the sweep workers each have their own grid
+            for (size_t i = nextRule++; i < rules.size(); i = nextRule++) {
+                results[i] = runSweepRule(rules[i], simulation, command, options);
+                std::cerr << "[" << ++finished << "/" << rules.size() << "] " << results[i].rule << " -> " << results[i].outcome << std::endl;
+            }
+        }));
+    }
+    for (thread &worker : workers) worker.join();
+
+    const string &report = command.report;
+    bool asJSON = report.size() >= 5 && report.compare(report.size() - 5, 5, ".json") == 0;
+    if (report.empty()) {
+        writeSweepReport(results, std::cout, false, command.seed, cellBounds);
+    }
+    else {
+        std::ofstream writer(report);
+        writeSweepReport(results, writer, asJSON, command.seed, cellBounds);
+        std::cerr << "Wrote report to '" << report << "'" << std::endl;
+    }
+}
+
+double timeTicks(Simulation &simulation, int ticks, vector<double> *threadBusy = nullptr) {
+    // Returns how many seconds ticks ticks took
+    const int ticksPerBatch = simulation.getConfig().ticksPerBatch;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int tick = 0; tick < ticks; tick += ticksPerBatch) {
+        simulation.update(std::min(ticksPerBatch, ticks - tick), threadBusy);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void benchKernels(const CommandLine &command, const SimulationConfig &configured) {
+    std::cout << std::left << std::setw(14) << "kernel" << std::setw(12) << "seconds" << std::setw(12) << "ticks/sec" <<
+        std::setw(14) << "Mcells/sec" << "speedup" << std::endl;
+
+    const char *names[] = { "generic", "specialized" };
+    double baseline = 0;
+    uint64_t firstHash = 0;
+    const double totalCells = pow(configured.cellBounds, 3);
+    for (int specialized = 0; specialized <= 1; specialized++) {
+        SimulationConfig config = configured;
+        config.specializedKernels = specialized;
+        // Same starting cells for every kernel, and the best of a few runs to cut down on noise
+        double seconds = 0;
+        TickStats stats;
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+            Simulation simulation(config);
+            std::mt19937 rng(command.seed);
+            simulation.randomize(rng);
+            double time = timeTicks(simulation, command.ticks);
+            stats = simulation.getStats();
+            if (repeat == 0 || time < seconds) seconds = time;
+        }
+        if (specialized == 0) {
+            baseline = seconds;
+            firstHash = stats.hash;
+        }
+        else if (stats.hash != firstHash) {
+            std::cout << "Warning: the kernels ended on different generations" << std::endl;
+        }
+        std::cout << std::left << std::setw(14) << names[specialized] << std::setw(12) << seconds <<
+            std::setw(12) << command.ticks / seconds << std::setw(14) << command.ticks * totalCells / seconds / 1e6 <<
+            "x" << baseline / seconds << std::endl;
+    }
+}
+
+void benchScheduler(const CommandLine &command, const SimulationConfig &configured) {
+    // Busy is how long each thread spent on tiles (over every tick), balance is the average busy time
+    // over the longest one (1 = every thread finished at the same time)
+    std::cout << std::left << std::setw(14) << "scheduler" << std::setw(12) << "seconds" << std::setw(12) << "ticks/sec" <<
+        std::setw(10) << "balance" << "busy seconds per thread" << std::endl;
+
+    const SchedulerMode modes[] = { STATIC, STEALING };
+    uint64_t firstHash = 0;
+    for (SchedulerMode mode : modes) {
+        SimulationConfig config = configured;
+        config.scheduler = mode;
+        double seconds = 0;
+        vector<double> busy;
+        TickStats stats;
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+            Simulation simulation(config);
+            std::mt19937 rng(command.seed);
+            simulation.randomize(rng);
+            vector<double> repeatBusy;
+            double time = timeTicks(simulation, command.ticks, &repeatBusy);
+            stats = simulation.getStats();
+            if (repeat == 0 || time < seconds) {
+                seconds = time;
+                busy = repeatBusy;
+            }
+        }
+        if (mode == STATIC) firstHash = stats.hash;
+        else if (stats.hash != firstHash) std::cout << "Warning: the schedulers ended on different generations" << std::endl;
+
+        double total = 0, longest = 0;
+        for (double time : busy) {
+            total += time;
+            longest = std::max(longest, time);
+        }
+        std::stringstream perThread;
+        perThread << std::fixed << std::setprecision(3);
+        for (double time : busy) perThread << time << " ";
+        std::cout << std::left << std::setw(14) << textFromEnum(mode) << std::setw(12) << seconds <<
+            std::setw(12) << command.ticks / seconds << std::setw(10) << (longest > 0 ? total / busy.size() / longest : 1) <<
+            perThread.str() << std::endl;
+    }
+}
+
+void benchBatch(const CommandLine &command, const SimulationConfig &configured) {
+    // Batches of 1 are the normal update, everything else is the temporally blocked one (see updateCellsBatch)
+    std::cout << std::left << std::setw(14) << "ticksPerBatch" << std::setw(12) << "seconds" << std::setw(12) << "ticks/sec" <<
+        std::setw(14) << "Mcells/sec" << "speedup" << std::endl;
+    if (!canBatch(configured.rules)) std::cout << "Note: this rule can't be batched, every batch size runs 1 tick at a time" << std::endl;
+
+    const int sizes[] = { 1, 2, 4, 8 };
+    const double totalCells = pow(configured.cellBounds, 3);
+    double baseline = 0;
+    uint64_t firstHash = 0;
+    for (int size : sizes) {
+        SimulationConfig config = configured;
+        config.ticksPerBatch = size;
+        double seconds = 0;
+        TickStats stats;
+        for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+            Simulation simulation(config);
+            std::mt19937 rng(command.seed);
+            simulation.randomize(rng);
+            double time = timeTicks(simulation, command.ticks);
+            stats = simulation.getStats();
+            if (repeat == 0 || time < seconds) seconds = time;
+        }
+        if (size == 1) {
+            baseline = seconds;
+            firstHash = stats.hash;
+        }
+        else if (stats.hash != firstHash) {
+            std::cout << "Warning: batches of " << size << " ended on a different generation" << std::endl;
+        }
+        std::cout << std::left << std::setw(14) << size << std::setw(12) << seconds <<
+            std::setw(12) << command.ticks / seconds << std::setw(14) << command.ticks * totalCells / seconds / 1e6 <<
+            "x" << baseline / seconds << std::endl;
+    }
+}
+
+void benchCounters(const CommandLine &command, const SimulationConfig &configured) {
+    // Hardware counters per cell (of the whole grid, quiet tiles included) for the phases of the update, with both kernels
+    // Counting and syncing run in the same tiles, so they are only counted together (tiles)
+    PerfCounters counters;
+    string error = counters.open();
+    if (!error.empty()) std::cout << "Note: no hardware counters, only the times are shown: " << error << std::endl;
+
+    std::cout << std::left << std::setw(14) << "kernel" << std::setw(12) << "phase" << std::setw(10) << "ns/cell" <<
+        std::setw(13) << "cycles/cell" << std::setw(12) << "instr/cell" << std::setw(8) << "IPC" <<
+        std::setw(18) << "LLC misses/1k" << "branch misses/1k" << std::endl;
+    const char *names[] = { "generic", "specialized" };
+    const Phase phases[] = { PHASE_TICK, PHASE_MASK, PHASE_TILES };
+    for (int specialized = 0; specialized <= 1; specialized++) {
+        SimulationConfig config = configured;
+        config.specializedKernels = specialized;
+        Simulation simulation(config);
+        std::mt19937 rng(command.seed);
+        simulation.randomize(rng);
+        counters.reset();
+        perfCounters = &counters;
+        for (int tick = 0; tick < command.ticks; tick += config.ticksPerBatch) {
+            ScopedTimer timer(PHASE_TICK);
+            simulation.update(std::min(config.ticksPerBatch, command.ticks - tick));
+        }
+        perfCounters = nullptr;
+
+        double cellTicks = pow(config.cellBounds, 3) * command.ticks;
+        for (Phase phase : phases) {
+            const PerfCounters::Totals &total = counters.total(phase);
+            if (total.calls == 0) continue; // batches of more than 1 tick don't have an alive mask phase
+            auto rate = [&](HardwareCounter counter, double per) {
+                if (!counters.available(counter)) return string("-");
+                std::stringstream text;
+                text << std::fixed << std::setprecision(2) << total.sum.values[counter] / cellTicks * per;
+                return text.str();
+            };
+            string ipc = "-";
+            if (counters.available(CYCLES) && counters.available(INSTRUCTIONS) && total.sum.values[CYCLES] > 0) {
+                std::stringstream text;
+                text << std::fixed << std::setprecision(2) << total.sum.values[INSTRUCTIONS] / total.sum.values[CYCLES];
+                ipc = text.str();
+            }
+            std::stringstream nanoseconds;
+            nanoseconds << std::fixed << std::setprecision(2) << total.sum.nanoseconds / cellTicks;
+            std::cout << std::left << std::setw(14) << names[specialized] << std::setw(12) << textFromEnum(phase) <<
+                std::setw(10) << nanoseconds.str() << std::setw(13) << rate(CYCLES, 1) << std::setw(12) << rate(INSTRUCTIONS, 1) <<
+                std::setw(8) << ipc << std::setw(18) << rate(LLC_MISSES, 1000) << rate(BRANCH_MISSES, 1000) << std::endl;
+        }
+    }
+}
+
+void runBenchmark(const CommandLine &command, const Options &options) {
+    const SimulationConfig &config = options.simulation;
+    std::cout << "Benchmark: " << ruleToString(config.rules) << ", cellBounds " << config.cellBounds << ", " << config.threads <<
+        " threads, " << command.ticks << " ticks, seed " << command.seed << std::endl;
+    if (command.benchmark == "scheduler") benchScheduler(command, config);
+    else if (command.benchmark == "batch") benchBatch(command, config);
+    else if (command.benchmark == "counters") benchCounters(command, config);
+    else benchKernels(command, config);
+}
+
+bool selftestHandoff() {
+    // A writer and a reader go through a TripleBuffer as fast as they can. Every generation's render buffer is filled with
+    // its own number, so one that was written to while it was being read would have more than 1 number in it, and the
+    // reader checks it before and after "drawing" it. It also has to only ever see newer generations
+    const size_t cellsPerGeneration = 64 * 64 * 64;
+    TripleBuffer<Generation> buffer;
+    std::atomic<bool> done{ false };
+    int published = 0;
+    thread writer([&]() {
+        for (int tick = 1; !done; tick++) {
+            Generation &generation = buffer.writing();
+            generation.render.hp.assign(cellsPerGeneration, tick);
+            generation.ticks = tick;
+            generation.stats.hash = tick;
+            buffer.publish();
+            published = tick;
+        }
+    });
+
+    auto whole = [&](const Generation &generation) {
+        if (generation.render.hp.size() != cellsPerGeneration || generation.stats.hash != (uint64_t)generation.ticks) return false;
+        for (int hp : generation.render.hp) {
+            if (hp != generation.ticks) return false;
+        }
+        return true;
+    };
+    size_t taken = 0, torn = 0, stale = 0;
+    int lastTicks = 0;
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::seconds(SELFTEST_SECONDS);
+    while (std::chrono::steady_clock::now() < end) {
+        const Generation *generation = buffer.takeNewest();
+        if (!generation) continue;
+        taken++;
+        bool ok = whole(*generation);
+        std::this_thread::sleep_for(std::chrono::microseconds(taken % 50)); // drawing, while the writer keeps going
+        ok = ok && whole(*generation);
+        torn += !ok;
+        stale += generation->ticks <= lastTicks;
+        lastTicks = generation->ticks;
+    }
+    done = true;
+    writer.join();
+
+    std::cout << "handoff: " << published << " generations published, " << taken << " taken, " <<
+        torn << " torn, " << stale << " out of order" << std::endl;
+    return taken > 0 && torn == 0 && stale == 0;
+}
+
+vector<int> referenceTick(const vector<int> &hp, const RuleSet &rules, int bounds) {
+    // The rules exactly as the README explains them, 1 cell at a time straight from the offsets (no mask, tiles,
+    // transition table or threads), which is what every engine has to match
+    vector<int> next(hp.size());
+    for (int x = 0; x < bounds; x++) {
+        for (int y = 0; y < bounds; y++) {
+            for (int z = 0; z < bounds; z++) {
+                size_t neighbors = 0;
+                for (const Vector3Int &offset : rules.offsets) {
+                    int nx = x + offset.x, ny = y + offset.y, nz = z + offset.z;
+                    bool outside = nx < 0 || nx >= bounds || ny < 0 || ny >= bounds || nz < 0 || nz >= bounds;
+                    if (outside && rules.boundary == CLIP) continue;
+                    if (nx < 0 || nx >= bounds) nx = ghostSource(nx, bounds, rules.boundary);
+                    if (ny < 0 || ny >= bounds) ny = ghostSource(ny, bounds, rules.boundary);
+                    if (nz < 0 || nz >= bounds) nz = ghostSource(nz, bounds, rules.boundary);
+                    neighbors += hp[threeToOne(nx, ny, nz, bounds)] == rules.state;
+                }
+                size_t i = threeToOne(x, y, z, bounds);
+                if (hp[i] == rules.state) next[i] = rules.survival[neighbors] ? rules.state : rules.state - 1;
+                else if (hp[i] < 0) next[i] = rules.spawn[neighbors] ? rules.state : -1;
+                else next[i] = hp[i] - 1;
+            }
+        }
+    }
+    return next;
+}
+
+vector<int> seededGeneration(int bounds, int state, unsigned int seed) {
+    // Uses the mt19937 numbers directly (the std distributions differ between standard libraries) so the
+    // golden hashes are the same everywhere. A third of the cells alive, the rest dead
+    std::mt19937 rng(seed);
+    vector<int> hp((size_t)bounds * bounds * bounds);
+    for (int &cell : hp) cell = rng() % 3 == 0 ? state : -1;
+    return hp;
+}
+
+uint64_t hashGeneration(const vector<int> &hp) {
+    uint64_t hash = 0;
+    for (size_t i = 0; i < hp.size(); i++) hash += cellHash(i, hp[i]);
+    return hash;
+}
+
+Simulation selftestSimulation(const RuleSet &rules, int bounds, const vector<int> &hp, size_t threads = 1,
+    SchedulerMode scheduler = STEALING, bool specializedKernels = true) {
+    // A Simulation of rules started from hp, the way every self test sets one up
+    SimulationConfig config;
+    config.rules = rules;
+    config.cellBounds = bounds;
+    config.threads = threads;
+    config.scheduler = scheduler;
+    config.specializedKernels = specializedKernels;
+    Simulation simulation(config);
+    simulation.setGeneration(hp, countGeneration(hp, rules.state), 0);
+    return simulation;
+}
+
+bool selftestEngines() {
+    // Every engine (both kernels, both schedulers, 1 and 3 threads, temporal blocking) against referenceTick
+    // on seeded grids, for many rules and every boundary mode, comparing the hash of every generation
+    // The grid sizes aren't multiples of TILE_SIZE so there are partial tiles and uneven slabs
+    const vector<Vector3Int> customOffsets = { { 0, 0, 2 }, { 0, 0, -2 }, { 1, 1, 0 }, { -2, 0, 1 }, { 0, 0, 0 } };
+    const char *rules[] = {
+        "4/4/5/M", "9-18/5-7,12-13,15/6/M", "2,6,9/4,6,8-9/10/M", "0-26/0/1/M", "3-5/2/4/M", "20-60/30-40/3/M2",
+        "0-6/1-3/2/VN", "1-3/1,3,5/7/VN", "0-3/0,2/3/VN", "5-9/6-8/2/VN2", "10-20/8-12/4/VN3", "1-3/1,2/1/custom"
+    };
+    struct Engine {
+        const char *name;
+        bool specialized;
+        SchedulerMode scheduler;
+        size_t threads;
+        int ticksPerBatch;
+    };
+    const Engine engines[] = {
+        { "generic kernels", false, STATIC, 1, 1 },
+        { "specialized kernels", true, STATIC, 1, 1 },
+        { "static, 3 threads", true, STATIC, 3, 1 },
+        { "stealing, 3 threads", true, STEALING, 3, 1 },
+        { "generic stealing, 3 threads", false, STEALING, 3, 1 },
+        { "batches of 2", true, STEALING, 3, 2 },
+        { "batches of 3", true, STATIC, 1, 3 }
+    };
+    const int sizes[] = { 7, 19, 37 };
+
+    size_t runs = 0, failed = 0;
+    for (int mode = CLIP; mode <= MIRROR; mode++) {
+        for (const char *text : rules) {
+            RuleSet ruleSet = parseRuleString(text, (BoundaryMode)mode, customOffsets);
+            for (int bounds : sizes) {
+                if (ruleSet.radius > bounds) continue;
+                vector<vector<int>> expected = { seededGeneration(bounds, ruleSet.state, bounds) };
+                for (int tick = 0; tick < SELFTEST_TICKS; tick++) expected.push_back(referenceTick(expected.back(), ruleSet, bounds));
+
+                for (const Engine &engine : engines) {
+                    Simulation simulation = selftestSimulation(ruleSet, bounds, expected[0], engine.threads, engine.scheduler, engine.specialized);
+                    runs++;
+                    for (int tick = 0; tick < SELFTEST_TICKS; tick += engine.ticksPerBatch) {
+                        int generations = std::min(engine.ticksPerBatch, SELFTEST_TICKS - tick);
+                        TickStats stats = simulation.update(generations);
+                        const vector<int> &want = expected[tick + generations];
+                        // The hash is updated from just the changed cells, so it is checked against both
+                        if (stats.hash != hashGeneration(want) || hashCells(simulation.getCells()) != stats.hash) {
+                            std::cout << "engines: " << engine.name << " differs from the reference on " << ruleToString(ruleSet) <<
+                                " " << textFromEnum((BoundaryMode)mode) << ", cellBounds " << bounds << ", at tick " << tick + generations << std::endl;
+                            failed++;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    std::cout << "engines: " << runs << " runs of " << SELFTEST_TICKS << " ticks, " << failed << " differed from the reference" << std::endl;
+
+    // The README examples from the same seeded grid, so a change to the semantics (not just a broken engine) is caught too
+    struct Golden {
+        const char *rule;
+        BoundaryMode boundary;
+        uint64_t hash;
+    };
+    const Golden goldens[] = {
+        { "9-18/5-7,12-13,15/6/M", CLIP, 0xa5220edb526a8aull },
+        { "9-18/5-7,12-13,15/6/M", WRAP, 0xc735b3ce8b3b07e6ull },
+        { "2,6,9/4,6,8-9/10/M", CLIP, 0xd1ea1773d218e6e6ull },
+        { "2,6,9/4,6,8-9/10/M", WRAP, 0x55efc33f301c1af3ull }
+    };
+    size_t goldenFailed = 0;
+    for (const Golden &golden : goldens) {
+        RuleSet ruleSet = parseRuleString(golden.rule, golden.boundary);
+        vector<int> hp = seededGeneration(SELFTEST_BOUNDS, ruleSet.state, 1);
+        Simulation simulation = selftestSimulation(ruleSet, SELFTEST_BOUNDS, hp);
+        TickStats stats = simulation.getStats();
+        for (int tick = 0; tick < SELFTEST_GOLDEN_TICKS; tick++) {
+            hp = referenceTick(hp, ruleSet, SELFTEST_BOUNDS);
+            stats = simulation.update(1);
+        }
+        uint64_t hash = hashGeneration(hp);
+        if (hash != golden.hash || stats.hash != golden.hash) {
+            std::cout << "engines: " << ruleToString(ruleSet) << " " << textFromEnum(golden.boundary) << " hashed to 0x" <<
+                std::hex << hash << " (reference) and 0x" << stats.hash << " instead of 0x" << golden.hash << std::dec << std::endl;
+            goldenFailed++;
+        }
+    }
+    std::cout << "engines: " << sizeof(goldens) / sizeof(goldens[0]) << " golden hashes, " << goldenFailed << " different" << std::endl;
+    return runs > 0 && failed == 0 && goldenFailed == 0;
+}
+
+vector<int> renderedCells(const RenderBuffer &buffer) {
+    // Every cell's hp back from a render buffer (it only has the drawn ones, the rest are dead)
+    const int bounds = buffer.cellBounds;
+    vector<int> hp((size_t)bounds * bounds * bounds, -1);
+    for (size_t i = 0; i < buffer.hp.size(); i++) {
+        Vector3Int index = instanceIndex(buffer, i);
+        hp[threeToOne(index.x, index.y, index.z, bounds)] = buffer.hp[i];
+    }
+    return hp;
+}
+
+bool selftestPool() {
+    // A few rules share a pool of workers while the "renderer" takes the newest generation of each of them.
+    // Every generation taken has to hash the same as that rule ticked on its own (replayed cycles included), its render
+    // buffer has to be the cells of that hash and stats, and every simulation has to get ticks (none of them starved by the others)
+    const char *rules[] = { "9-18/5-7,12-13,15/6/M", "2,6,9/4,6,8-9/10/M", "4/4/5/M", "0-6/1,3/2/VN", "5-7/6/2/M" };
+    const size_t count = sizeof(rules) / sizeof(rules[0]);
+    vector<Simulation> simulations;
+    for (size_t i = 0; i < count; i++) {
+        RuleSet ruleSet = parseRuleString(rules[i], WRAP);
+        vector<int> hp = seededGeneration(SELFTEST_BOUNDS, ruleSet.state, (unsigned int)i + 1);
+        simulations.push_back(selftestSimulation(ruleSet, SELFTEST_BOUNDS, hp));
+    }
+
+    // The ticks and hash of every generation taken, checked once the pool is stopped
+    vector<vector<std::pair<int, uint64_t>>> taken(count);
+    size_t torn = 0;
+    TickProducer producer;
+    producer.start(simulations, 3);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::seconds(SELFTEST_SECONDS);
+    while (std::chrono::steady_clock::now() < end) {
+        for (size_t i = 0; i < count; i++) {
+            const Generation *generation = producer.takeNewest(i);
+            if (!generation) continue;
+            vector<int> hp = renderedCells(generation->render);
+            TickStats counted = countGeneration(hp, simulations[i].getConfig().rules.state);
+            torn += hashGeneration(hp) != generation->stats.hash || counted.aliveCells != generation->stats.aliveCells ||
+                counted.dyingCells != generation->stats.dyingCells || counted.deadCells != generation->stats.deadCells;
+            taken[i].push_back({ generation->ticks, generation->stats.hash });
+        }
+    }
+    producer.stop();
+
+    size_t failed = 0, starved = 0;
+    int fewest = -1, most = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (taken[i].empty()) {
+            starved++;
+            continue;
+        }
+        Simulation alone = simulations[i];
+        for (const std::pair<int, uint64_t> &generation : taken[i]) {
+            while (alone.getTicks() < generation.first) alone.update(1);
+            if (alone.getStats().hash != generation.second) {
+                std::cout << "pool: " << rules[i] << " differs from ticking it alone at tick " << generation.first << std::endl;
+                failed++;
+                break;
+            }
+        }
+        fewest = fewest < 0 ? taken[i].back().first : std::min(fewest, taken[i].back().first);
+        most = std::max(most, taken[i].back().first);
+    }
+    std::cout << "pool: " << count << " simulations on 3 workers, " << fewest << " to " << most << " ticks each, " <<
+        starved << " starved, " << torn << " torn, " << failed << " differed from ticking alone" << std::endl;
+    return starved == 0 && torn == 0 && failed == 0;
+}
+
+struct SelftestClip {
+    CellBox box;
+    vector<ClipPlane> planes;
+};
+
+bool rayBlocked(const vector<int> &hp, const ChunkGrid &grid, int bounds, Vector3Float eye, Vector3Float point, Vector3Int target) {
+    // Walks the cells the ray from eye to point goes through (in order, Amanatides and Woo) and returns whether
+    // it went through a drawn cell before getting to target. The cell the eye is in doesn't count (backface culling)
+    Vector3Float origin = cellCorner({ 0, 0, 0 }, bounds);
+    float start[3] = { eye.x - origin.x, eye.y - origin.y, eye.z - origin.z };
+    float end[3] = { point.x - origin.x, point.y - origin.y, point.z - origin.z };
+    int cell[3], step[3];
+    float next[3], delta[3];
+    for (int axis = 0; axis < 3; axis++) {
+        float direction = end[axis] - start[axis];
+        cell[axis] = (int)floor(start[axis]);
+        step[axis] = direction >= 0 ? 1 : -1;
+        delta[axis] = direction != 0 ? 1.0f / fabs(direction) : INFINITY;
+        float toEdge = direction >= 0 ? cell[axis] + 1 - start[axis] : start[axis] - cell[axis];
+        next[axis] = toEdge * delta[axis];
+    }
+    for (bool first = true; ; first = false) {
+        if (cell[0] == target.x && cell[1] == target.y && cell[2] == target.z) return false;
+        bool inside = cellInside(grid, { cell[0], cell[1], cell[2] });
+        if (!first && inside && hp[threeToOne(cell[0], cell[1], cell[2], bounds)] >= 0) return true;
+        int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+        if (next[axis] > 1) return false; // went past the point without going through target (rounding)
+        cell[axis] += step[axis];
+        next[axis] += delta[axis];
+    }
+}
+
+bool selftestCulling() {
+    // Random cameras around (and inside) a grid with some completely full chunks. Every chunk visibleChunks() leaves out
+    // is checked without it: the corners and center of its cells have to be off screen when it was outside the frustum,
+    // and the rays to them have to go through another drawn cell first when it was occluded
+    const int bounds = 44; // not a multiple of CHUNK_SIZE, so there are smaller chunks on the edges
+    const int state = 1;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    vector<int> hp((size_t)bounds * bounds * bounds);
+    for (int x = 0; x < bounds; x++) {
+        for (int y = 0; y < bounds; y++) {
+            for (int z = 0; z < bounds; z++) {
+                // Every other chunk along x is full, the rest a third alive
+                bool full = (x / CHUNK_SIZE) % 2 == 1 && (y / CHUNK_SIZE + z / CHUNK_SIZE) % 3 != 0;
+                hp[threeToOne(x, y, z, bounds)] = full || rng() % 3 == 0 ? state : -1;
+            }
+        }
+    }
+    Simulation simulation = selftestSimulation(parseRuleString("4/4/1/M"), bounds, hp);
+
+    const SelftestClip clips[] = {
+        { { { 0, 0, 0 }, { bounds, bounds, bounds } }, {} },
+        { { { 0, 0, 0 }, { bounds / 2, bounds, bounds } }, {} },
+        { { { 5, 11, 0 }, { 37, 30, 41 } }, {} },
+        { { { 0, 0, 0 }, { bounds, bounds, bounds } }, { { normalize({ 1, 1, 0.5f }), -30 }, { normalize({ 0, -1, 0.3f }), 30 } } }
+    };
+    size_t cameras = 0, frustumCulled = 0, occluded = 0, checked = 0, wrong = 0, cellsLeft = 0, cellsInBox = 0;
+    for (int i = 0; i < SELFTEST_CAMERAS; i++) {
+        for (const SelftestClip &clip : clips) {
+            float lat = (unit(rng) - 0.5f) * 170.0f * 3.14159265f / 180.0f;
+            float lon = unit(rng) * 2 * 3.14159265f;
+            float radius = (0.2f + unit(rng) * 1.8f) * bounds;
+            ViewCamera view;
+            view.position = { radius * cos(lat) * cos(lon), radius * cos(lat) * sin(lon), radius * sin(lat) };
+            view.target = { (unit(rng) - 0.5f) * bounds * 0.5f, (unit(rng) - 0.5f) * bounds * 0.5f, (unit(rng) - 0.5f) * bounds * 0.5f };
+            view.up = { 0, 0, 1 };
+            view.fovy = 30 + unit(rng) * 60;
+            view.aspect = 0.5f + unit(rng) * 1.5f;
+            cameras++;
+
+            ChunkGrid grid = countChunks(simulation.getCells(), bounds, clip.box, clip.planes);
+            CullStats stats;
+            vector<int> visible = visibleChunks(grid, view, stats);
+            frustumCulled += stats.frustumCulled;
+            occluded += stats.occluded;
+            size_t drawnCells = 0;
+            for (int chunk : visible) drawnCells += grid.drawn[chunk];
+            if (drawnCells != stats.drawnCells) wrong++;
+            cellsLeft += drawnCells;
+            for (int drawn : grid.drawn) cellsInBox += drawn;
+
+            // The camera's axes, to check the frustum a different way than its planes
+            Vector3Float forward = normalize(view.target - view.position);
+            Vector3Float right = normalize(cross(forward, view.up));
+            Vector3Float up = cross(right, forward);
+            float tanY = tan(view.fovy * 3.14159265f / 360.0f), tanX = tanY * view.aspect;
+            auto onScreen = [&](Vector3Float point) {
+                Vector3Float relative = point - view.position;
+                float depth = dot(relative, forward);
+                return depth >= CULL_NEAR && depth <= CULL_FAR && fabs(dot(relative, right)) <= depth * tanX &&
+                    fabs(dot(relative, up)) <= depth * tanY;
+            };
+
+            Frustum frustum = makeFrustum(view);
+            vector<bool> shown(grid.drawn.size(), false);
+            for (int chunk : visible) shown[chunk] = true;
+            for (size_t chunk = 0; chunk < grid.drawn.size(); chunk++) {
+                if (grid.drawn[chunk] == 0 || shown[chunk]) continue;
+                CellBox part = chunkCells(grid, (int)chunk);
+                bool outside = boxOutside(frustum, cellCorner(part.min, bounds), cellCorner(part.max, bounds));
+                for (int x = part.min.x; x < part.max.x; x++) {
+                    for (int y = part.min.y; y < part.max.y; y++) {
+                        for (int z = part.min.z; z < part.max.z; z++) {
+                            // A few cells of each chunk, all of them would take too long
+                            if (hp[threeToOne(x, y, z, bounds)] < 0 || !cellInside(grid, { x, y, z }) || rng() % 16 != 0) continue;
+                            Vector3Float corner = cellCorner({ x, y, z }, bounds);
+                            Vector3Float points[9] = { { corner.x + 0.5f, corner.y + 0.5f, corner.z + 0.5f } };
+                            for (int i = 0; i < 8; i++) {
+                                // The corners, a bit inside so the rays don't go along the edges
+                                points[i + 1] = { corner.x + (i & 1 ? 0.95f : 0.05f), corner.y + (i & 2 ? 0.95f : 0.05f), corner.z + (i & 4 ? 0.95f : 0.05f) };
+                            }
+                            for (const Vector3Float &point : points) {
+                                checked++;
+                                if (outside) wrong += onScreen(point);
+                                else wrong += !rayBlocked(hp, grid, bounds, view.position, point, { x, y, z });
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    std::cout << "culling: " << cameras << " cameras, " << frustumCulled << " chunks outside the frustum and " << occluded <<
+        " occluded (" << cellsLeft * 100 / std::max<size_t>(cellsInBox, 1) << "% of the cells left), " << checked << " points checked, " <<
+        wrong << " wrong" << std::endl;
+    // It didn't test anything if nothing was culled
+    return frustumCulled > 0 && occluded > 0 && wrong == 0;
+}
+
+bool selftestLod() {
+    // Every block of the pyramid against its cells counted 1 at a time, on a grid that isn't a multiple of any block size
+    // and built twice into the same pyramid (like publish() does), then the levels a camera picks going further away
+    const int bounds = 37;
+    const int state = 6;
+    std::mt19937 rng(11);
+    LodPyramid pyramid;
+    size_t blocks = 0, wrong = 0;
+    for (int run = 0; run < 2; run++) {
+        // On 1 update thread, then 3 (each one doing the blocks of its slab)
+        vector<int> hp((size_t)bounds * bounds * bounds);
+        for (int &cell : hp) cell = (int)(rng() % (state + 2)) - 1;
+        Simulation simulation = selftestSimulation(parseRuleString("4/4/6/M"), bounds, hp, run == 0 ? 1 : 3);
+        buildPyramid(simulation, pyramid);
+        for (const LodLevel &level : pyramid.levels) {
+            for (int x = 0; x < level.blocksPerEdge; x++) {
+                for (int y = 0; y < level.blocksPerEdge; y++) {
+                    for (int z = 0; z < level.blocksPerEdge; z++) {
+                        CellBox block = blockCells(level, bounds, { x, y, z });
+                        size_t drawn = 0, hpSum = 0;
+                        for (int cx = block.min.x; cx < block.max.x; cx++) {
+                            for (int cy = block.min.y; cy < block.max.y; cy++) {
+                                for (int cz = block.min.z; cz < block.max.z; cz++) {
+                                    int cell = hp[threeToOne(cx, cy, cz, bounds)];
+                                    if (cell < 0) continue;
+                                    drawn++;
+                                    hpSum += cell;
+                                }
+                            }
+                        }
+                        size_t i = threeToOne(x, y, z, level.blocksPerEdge);
+                        blocks++;
+                        wrong += level.drawn[i] != drawn || level.hpSum[i] != hpSum;
+                    }
+                }
+            }
+        }
+    }
+
+    // Moving the camera away from a chunk never makes it finer, and it goes from the cells to the biggest blocks
+    ViewCamera view = { { 0, 0, 0 }, { 1, 0.3f, 0.2f }, { 0, 0, 1 }, 60, 16 / 9.0f };
+    Vector3Float direction = normalize(view.target);
+    int previous = 0, finest = LOD_LEVELS, coarsest = 0;
+    for (float distance = 1; distance < CULL_FAR; distance *= 1.1f) {
+        Vector3Float min = direction * distance;
+        int level = lodLevel(view, 675, min, min + Vector3Float{ CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE });
+        if (level < previous) wrong++;
+        previous = level;
+        finest = std::min(finest, level);
+        coarsest = std::max(coarsest, level);
+    }
+    std::cout << "lod: " << blocks << " blocks checked, " << wrong << " wrong, levels " << finest << " to " << coarsest << std::endl;
+    return wrong == 0 && finest == 0 && coarsest == LOD_LEVELS;
+}
+
+bool selftestRender() {
+    // The render buffer built on 1 and 3 threads against the cells: the same instances in both, every drawn cell once,
+    // in its chunk and in x, y, z order, with the draw mode's color. Then the chunks counted from it against the cells
+    // with slabs and clip planes, and the slices of it against every cell
+    const int bounds = 45;
+    const int state = 4;
+    std::mt19937 rng(13);
+    vector<int> hp((size_t)bounds * bounds * bounds);
+    for (int x = 0; x < bounds; x++) {
+        for (int y = 0; y < bounds; y++) {
+            for (int z = 0; z < bounds; z++) {
+                // Some chunks full, so the grids have solid ones to compare too
+                bool full = (x / CHUNK_SIZE + y / CHUNK_SIZE + z / CHUNK_SIZE) % 4 == 0;
+                hp[threeToOne(x, y, z, bounds)] = full ? state : (int)(rng() % (state + 3)) - 2;
+            }
+        }
+    }
+    const Palette palette = { { 200, 40, 30, 255 }, { 20, 60, 180, 255 }, { 250, 200, 0, 255 }, { 90, 220, 120, 255 }, { 255, 0, 255, 255 } };
+    size_t instances = 0, wrong = 0;
+    vector<RenderBuffer> buffers;
+    for (size_t threads : { 1, 3 }) {
+        Simulation simulation = selftestSimulation(parseRuleString("4/4/4/M"), bounds, hp, threads);
+        RenderScratch scratch;
+        for (int mode = 0; mode < 5; mode++) {
+            buffers.push_back(RenderBuffer());
+            buildRenderBuffer(simulation, (DrawMode)mode, palette, buffers.back(), scratch);
+        }
+        // Colored again from another mode has to be the same as built with it
+        RenderBuffer recolored = buffers[buffers.size() - 5];
+        recolorRenderBuffer(recolored, CENTER_DIST, palette);
+        wrong += recolored.colors.size() != buffers.back().colors.size() ||
+            !std::equal(recolored.colors.begin(), recolored.colors.end(), buffers.back().colors.begin(), [](InstanceColor a, InstanceColor b) {
+                return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+            });
+    }
+
+    const int chunks = (bounds + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    size_t drawnCells = 0;
+    for (int cell : hp) drawnCells += cell >= 0;
+    for (size_t b = 0; b < buffers.size(); b++) {
+        const RenderBuffer &buffer = buffers[b];
+        const DrawMode mode = (DrawMode)(b % 5);
+        wrong += buffer.hp.size() != drawnCells || buffer.chunkStart.back() != drawnCells;
+        const RenderBuffer &first = buffers[b % 5];
+        wrong += buffer.hp != first.hp || buffer.chunkStart != first.chunkStart || buffer.positions.size() != first.positions.size() ||
+            !std::equal(buffer.positions.begin(), buffer.positions.end(), first.positions.begin(), [](Vector3Float a, Vector3Float b) {
+                return a.x == b.x && a.y == b.y && a.z == b.z;
+            });
+        for (size_t chunk = 0; chunk + 1 < buffer.chunkStart.size(); chunk++) {
+            Vector3Int previous = { -1, -1, -1 };
+            for (size_t i = buffer.chunkStart[chunk]; i < buffer.chunkStart[chunk + 1] && i < buffer.hp.size(); i++) {
+                Vector3Int index = instanceIndex(buffer, i);
+                instances++;
+                bool after = index.x > previous.x || (index.x == previous.x && (index.y > previous.y || (index.y == previous.y && index.z > previous.z)));
+                previous = index;
+                if (!after || threeToOne(index.x / CHUNK_SIZE, index.y / CHUNK_SIZE, index.z / CHUNK_SIZE, chunks) != chunk ||
+                    hp[threeToOne(index.x, index.y, index.z, bounds)] != buffer.hp[i]) {
+                    wrong++;
+                    continue;
+                }
+                InstanceColor color = cellColor(palette, mode, buffer.hp[i], { (float)index.x, (float)index.y, (float)index.z }, bounds, state);
+                wrong += color.r != buffer.colors[i].r || color.g != buffer.colors[i].g || color.b != buffer.colors[i].b;
+            }
+        }
+    }
+
+    Simulation simulation = selftestSimulation(parseRuleString("4/4/4/M"), bounds, hp);
+    const SelftestClip clips[] = {
+        { { { 0, 0, 0 }, { bounds, bounds, bounds } }, {} },
+        { { { 0, 0, 0 }, { bounds / 2, bounds, bounds } }, {} },
+        { { { 5, 11, 0 }, { 37, 30, 41 } }, {} },
+        { { { 0, 0, 0 }, { bounds, bounds, bounds } }, { { normalize({ 1, -2, 0.5f }), 10 } } },
+        { { { 3, 0, 9 }, { 40, 45, 33 } }, { { { 0, 0, 1 }, -17 }, { normalize({ -1, -1, -1 }), 60 } } }
+    };
+    // The slice planes: along an axis and not, and 1 right between 2 layers of cells (only the layer on its back side is in it)
+    const ClipPlane slices[] = {
+        { { 1, 0, 0 }, -20 },
+        { { 0, 0, -1 }, 30.5f },
+        { normalize({ 2, 1, -1 }), -12 },
+        { normalize({ 0.3f, -0.2f, 1 }), -9 }
+    };
+    size_t solid = 0, sliceCells = 0, sliceChunks = 0, chunksWithCells = 0;
+    for (const SelftestClip &clip : clips) {
+        ChunkGrid fromCells = countChunks(simulation.getCells(), bounds, clip.box, clip.planes);
+        ChunkGrid fromBuffer = countChunks(buffers[0], clip.box, clip.planes);
+        wrong += fromCells.drawn != fromBuffer.drawn || fromCells.solid != fromBuffer.solid;
+        for (bool chunkSolid : fromBuffer.solid) solid += chunkSolid;
+
+        // Against the cells counted 1 at a time, and every slice against the cells that are within half a cell of it
+        vector<int> drawn(fromCells.drawn.size(), 0);
+        for (int x = 0; x < bounds; x++) {
+            for (int y = 0; y < bounds; y++) {
+                for (int z = 0; z < bounds; z++) {
+                    if (hp[threeToOne(x, y, z, bounds)] >= 0 && cellInside(fromCells, { x, y, z })) drawn[threeToOne(x / CHUNK_SIZE, y / CHUNK_SIZE, z / CHUNK_SIZE, chunks)]++;
+                }
+            }
+        }
+        wrong += drawn != fromCells.drawn;
+        for (const ClipPlane &plane : slices) {
+            size_t expected = 0;
+            for (int x = 0; x < bounds; x++) {
+                for (int y = 0; y < bounds; y++) {
+                    for (int z = 0; z < bounds; z++) {
+                        float distance = planeDistance(plane, { x, y, z });
+                        expected += hp[threeToOne(x, y, z, bounds)] >= 0 && cellInside(fromCells, { x, y, z }) && distance >= -0.5f && distance < 0.5f;
+                    }
+                }
+            }
+            CullStats stats;
+            vector<size_t> slice = sliceInstances(buffers[0], makeChunkGrid(bounds, clip.box, clip.planes), plane, stats);
+            wrong += slice.size() != expected || stats.drawnCells != expected || !std::is_sorted(slice.begin(), slice.end()) ||
+                std::adjacent_find(slice.begin(), slice.end()) != slice.end();
+            for (size_t i : slice) {
+                float distance = planeDistance(plane, instanceIndex(buffers[0], i));
+                wrong += !cellInside(fromCells, instanceIndex(buffers[0], i)) || distance < -0.5f || distance >= 0.5f;
+            }
+            sliceCells += slice.size();
+            sliceChunks += stats.sliceChunks;
+            chunksWithCells += stats.chunks;
+        }
+    }
+    std::cout << "render: " << buffers.size() << " buffers, " << instances << " instances checked, " << solid << " solid chunks, " <<
+        sliceCells << " cells in the slices from " << sliceChunks << " of " << chunksWithCells << " chunks, " << wrong << " wrong" << std::endl;
+    // A slice that had to look at most of the chunks didn't skip anything
+    return wrong == 0 && instances == drawnCells * buffers.size() && solid > 0 && sliceCells > 0 && sliceChunks * 3 < chunksWithCells;
+}
+
+bool runSelftest(const string &name) {
+    bool passed;
+    if (name == "engines") passed = selftestEngines();
+    else if (name == "pool") passed = selftestPool();
+    else if (name == "culling") passed = selftestCulling();
+    else if (name == "lod") passed = selftestLod();
+    else if (name == "render") passed = selftestRender();
+    else passed = selftestHandoff();
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    return passed;
+}
+
+bool isHeadless(const CommandLine &command) {
+    return !command.selftest.empty() || !command.sweepRules.empty() || !command.benchmark.empty();
+}
+
+int runHeadless(const CommandLine &command) {
+    if (!command.selftest.empty()) {
+        return runSelftest(command.selftest) ? 0 : EXIT_FAILURE;
+    }
+    Options options;
+    try {
+        options = loadOptions(command.optionsFile, command.overrides);
+    }
+    catch (std::exception& e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        std::cout << "JSON '" << command.optionsFile << "' not found or invalid." << std::endl;
+        std::cout << "Exiting..." << std::endl;
+        return EXIT_FAILURE;
+    }
+    profiling = options.profile;
+    try {
+        if (options.trace) traceRecorder.start();
+        if (!command.benchmark.empty()) runBenchmark(command, options);
+        else runSweep(command, options);
+        if (profiling) printPhaseTimes(std::cerr);
+        if (tracing) traceRecorder.stop(TRACE_FILE);
+    }
+    catch (std::exception& e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+#include "options.h"
+
+using std::string;
+
+
+#define BENCH_REPEATS 3
+#define SELFTEST_SECONDS 2
+#define SELFTEST_TICKS 12
+#define SELFTEST_BOUNDS 24
+#define SELFTEST_GOLDEN_TICKS 40
+#define SELFTEST_CAMERAS 40
+
+
+// Whether the command line asks for one of the modes without a window (a sweep, benchmark or self test)
+bool isHeadless(const CommandLine &command);
+// Loads the options and runs that mode, returns the exit code (used by both the viewer and the runner)
+int runHeadless(const CommandLine &command);
+
+// The modes without a window, they throw std::exception when the options don't work for them
+void runSweep(const CommandLine &command, const Options &options);
+void runBenchmark(const CommandLine &command, const Options &options);
+// Prints PASSED or FAILED and returns whether it passed
+bool runSelftest(const string &name);
@@ -0,0 +1,168 @@
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "instrumentation.h"
+
+
+std::atomic<bool> profiling{ false };
+std::atomic<bool> tracing{ false };
+thread_local int traceLane = -1;
+
+PhaseTimes phaseTimes;
+TraceRecorder traceRecorder;
+PerfCounters *perfCounters = nullptr;
+
+
+string textFromEnum(Phase phase) {
+    switch (phase) {
+        case PHASE_TICK: return "tick";
+        case PHASE_MASK: return "alive mask";
+        case PHASE_TILES: return "tiles";
+        case PHASE_COUNT: return "count";
+        case PHASE_SYNC: return "sync";
+        case PHASE_PUBLISH: return "publish";
+        case PHASE_RENDER: return "render buffer";
+        case PHASE_FRAME: return "frame";
+        case PHASE_TAKE: return "take newest";
+        case PHASE_DRAW_CELLS: return "draw cells";
+        case PHASE_HUD: return "HUD";
+        case PHASE_PRESENT: return "present";
+        case TOTAL_PHASES: break;
+    }
+    return "";
+}
+
+
+PhaseTimes::Summary PhaseTimes::summary(Phase phase) const {
+    vector<double> sorted;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        sorted = samples[phase];
+    }
+    Summary result = { sorted.size(), 0, 0, 0, 0 };
+    if (sorted.empty()) return result;
+    std::sort(sorted.begin(), sorted.end());
+    for (double seconds : sorted) result.average += seconds;
+    result.average /= sorted.size();
+    result.p50 = sorted[sorted.size() / 2];
+    result.p95 = sorted[std::min(sorted.size() - 1, sorted.size() * 95 / 100)];
+    result.max = sorted.back();
+    return result;
+}
+
+void printPhaseTimes(std::ostream &out) {
+    out << "Phase timings (ms, last " << PHASE_SAMPLES << " samples, count and sync are added up over the update threads):" << std::endl;
+    out << std::left << std::setw(22) << "phase" << std::setw(10) << "samples" << std::setw(10) << "average" <<
+        std::setw(10) << "p50" << std::setw(10) << "p95" << "max" << std::endl;
+    out << std::fixed << std::setprecision(3);
+    for (int phase = 0; phase < TOTAL_PHASES; phase++) {
+        PhaseTimes::Summary times = phaseTimes.summary((Phase)phase);
+        if (times.samples == 0) continue;
+        out << std::setw(22) << textFromEnum((Phase)phase) << std::setw(10) << times.samples << std::setw(10) << times.average * 1000 <<
+            std::setw(10) << times.p50 * 1000 << std::setw(10) << times.p95 * 1000 << times.max * 1000 << std::endl;
+    }
+    out << std::defaultfloat;
+}
+
+
+string TraceRecorder::laneName(int lane) {
+    if (lane == TRACE_MAIN) return "main";
+    if (lane == TRACE_SIMULATION) return "simulation";
+    return "worker " + std::to_string(lane - TRACE_WORKERS);
+}
+
+int64_t TraceRecorder::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void TraceRecorder::stop(const string &file) {
+    tracing = false;
+    int current = session.load();
+    std::ofstream out(file);
+    if (!out) {
+        std::cout << "Error: could not write the trace to " << file << std::endl;
+        return;
+    }
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+    out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"3D Cellular Automata\"}}";
+    size_t written = 0;
+    for (int i = 0; i < TRACE_LANES; i++) {
+        Lane &lane = lanes[i];
+        if (lane.session.load(std::memory_order_acquire) != current) continue;
+        size_t size = lane.size.load(std::memory_order_acquire);
+        out << "," << std::endl << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << i <<
+            ", \"args\": {\"name\": \"" << laneName(i) << "\"}}";
+        for (size_t e = 0; e < size; e++) {
+            const Event &event = lane.events[e];
+            out << "," << std::endl << "{\"name\": \"" << textFromEnum(event.phase) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << i <<
+                ", \"ts\": " << (event.begin - sessionStart) / 1000.0 << ", \"dur\": " << (event.end - event.begin) / 1000.0 << "}";
+        }
+        written += size;
+    }
+    out << std::endl << "]}" << std::endl;
+    std::cout << "Trace: " << written << " events written to " << file;
+    if (dropped > 0) std::cout << " (" << dropped << " dropped, " << TRACE_EVENTS << " per thread max)";
+    std::cout << std::endl;
+}
+
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (int counter = 0; counter < TOTAL_COUNTERS; counter++) {
+        if (fds[counter] >= 0) close(fds[counter]);
+    }
+#endif
+}
+
+string PerfCounters::open() {
+#ifdef __linux__
+    const uint64_t configs[TOTAL_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    string error;
+    for (int counter = 0; counter < TOTAL_COUNTERS; counter++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[counter];
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // When there are more counters than the CPU has, they take turns, and the counts are scaled up (see read())
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds[counter] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fds[counter] < 0) error = strerror(errno);
+    }
+    for (int counter = 0; counter < TOTAL_COUNTERS; counter++) {
+        if (fds[counter] >= 0) return "";
+    }
+    return "perf_event_open failed (" + error + ")";
+#else
+    return "hardware counters are only read on Linux";
+#endif
+}
+
+PerfCounters::Reading PerfCounters::read() const {
+    Reading reading = { TraceRecorder::now(), {} };
+#ifdef __linux__
+    for (int counter = 0; counter < TOTAL_COUNTERS; counter++) {
+        uint64_t values[3]; // count, time enabled, time running
+        if (fds[counter] < 0 || ::read(fds[counter], values, sizeof(values)) != sizeof(values)) continue;
+        reading.values[counter] = values[2] > 0 ? (double)values[0] * values[1] / values[2] : 0;
+    }
+#endif
+    return reading;
+}
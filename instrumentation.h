@@ -0,0 +1,240 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+
+#define PHASE_SAMPLES 120
+#define TRACE_FILE "trace.json"
+#define TRACE_LANES 64
+#define TRACE_EVENTS (1 << 16)
+
+
+enum HardwareCounter {
+    CYCLES,
+    INSTRUCTIONS,
+    LLC_MISSES,
+    BRANCH_MISSES,
+    TOTAL_COUNTERS
+};
+
+enum TraceThread {
+    TRACE_MAIN,
+    TRACE_SIMULATION,
+    TRACE_WORKERS
+};
+
+enum Phase {
+    // Simulation thread
+    PHASE_TICK,
+    PHASE_MASK,
+    PHASE_TILES,
+    PHASE_COUNT, // summed over the worker threads
+    PHASE_SYNC, // summed over the worker threads
+    PHASE_PUBLISH,
+    PHASE_RENDER, // the render buffer (see render.h), also on the update threads
+    // Main thread
+    PHASE_FRAME,
+    PHASE_TAKE,
+    PHASE_DRAW_CELLS,
+    PHASE_HUD,
+    PHASE_PRESENT,
+    TOTAL_PHASES
+};
+
+
+// These are for the whole process rather than a Simulation: every simulation's phases are timed and traced together
+
+// When off, the ScopedTimers don't even read the clock (toggled with T or the profile option)
+extern std::atomic<bool> profiling;
+
+// Recording a trace (see TraceRecorder), started with L or the trace option
+extern std::atomic<bool> tracing;
+// Which lane of the trace this thread's events go to: a TraceThread, TRACE_WORKERS + i for update thread i
+// (or worker i of a wall of simulations, see TickProducer), or -1 for threads that aren't traced (like the sweep workers)
+extern thread_local int traceLane;
+
+
+string textFromEnum(Phase phase);
+
+
+class PhaseTimes {
+    // The last PHASE_SAMPLES durations (in seconds) of every phase, added to by whichever thread runs it
+private:
+    mutable std::mutex lock;
+    vector<double> samples[TOTAL_PHASES];
+    size_t added[TOTAL_PHASES] = {};
+public:
+    struct Summary {
+        size_t samples;
+        double average, p50, p95, max;
+    };
+
+    void add(Phase phase, double seconds) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (samples[phase].size() < PHASE_SAMPLES) samples[phase].push_back(seconds);
+        else samples[phase][added[phase] % PHASE_SAMPLES] = seconds;
+        added[phase]++;
+    }
+    Summary summary(Phase phase) const;
+};
+
+extern PhaseTimes phaseTimes;
+
+void printPhaseTimes(std::ostream &out);
+
+
+class TraceRecorder {
+    // Every traced thread appends its events to its own lane (see traceLane), so recording takes no locks
+    // A lane only has 1 writer at a time: the update threads are new every tick, but they are joined before the next tick
+    // The lanes are only read by the main thread, which only reads the events a lane has finished writing (size)
+private:
+    struct Event {
+        Phase phase;
+        int64_t begin, end; // ns, see now()
+    };
+    struct Lane {
+        std::atomic<int> session{ 0 };
+        std::atomic<size_t> size{ 0 };
+        vector<Event> events;
+    };
+    Lane lanes[TRACE_LANES];
+    std::atomic<int> session{ 0 };
+    std::atomic<size_t> dropped{ 0 };
+    int64_t sessionStart = 0;
+
+    static string laneName(int lane);
+
+public:
+    static int64_t now();
+
+    // start() and stop() are only called from the main thread
+    void start() {
+        sessionStart = now();
+        dropped = 0;
+        session++;
+        tracing = true;
+    }
+    void record(Phase phase, int64_t begin, int64_t end) {
+        if (traceLane < 0 || traceLane >= TRACE_LANES) return;
+        Lane &lane = lanes[traceLane];
+        int current = session.load(std::memory_order_acquire);
+        if (lane.session.load(std::memory_order_relaxed) != current) {
+            // The lane's first event since start(): its writer is the one that clears it
+            lane.events.resize(TRACE_EVENTS);
+            lane.size.store(0, std::memory_order_relaxed);
+            lane.session.store(current, std::memory_order_release);
+        }
+        size_t size = lane.size.load(std::memory_order_relaxed);
+        if (size == TRACE_EVENTS) {
+            dropped++;
+            return;
+        }
+        lane.events[size] = { phase, begin, end };
+        lane.size.store(size + 1, std::memory_order_release);
+    }
+    // Stops recording and writes everything since start() as Chrome trace JSON (chrome://tracing or ui.perfetto.dev)
+    void stop(const string &file);
+};
+
+extern TraceRecorder traceRecorder;
+
+
+class PerfCounters {
+    // Hardware counters (Linux perf_event_open) for the thread that opened them and every thread it starts afterwards
+    // (the update threads are new every tick, their counts are added in when they are joined)
+    // Totals are kept per phase, added to by the ScopedTimers while this is perfCounters
+public:
+    struct Reading {
+        int64_t nanoseconds;
+        double values[TOTAL_COUNTERS];
+    };
+    struct Totals {
+        size_t calls;
+        Reading sum;
+    };
+
+private:
+    int fds[TOTAL_COUNTERS];
+    Totals totals[TOTAL_PHASES];
+
+public:
+    PerfCounters() {
+        for (int counter = 0; counter < TOTAL_COUNTERS; counter++) fds[counter] = -1;
+        reset();
+    }
+    ~PerfCounters();
+
+    // Returns "" if at least 1 counter could be opened, or why none could
+    // (not Linux, no PMU like in most VMs and containers, or kernel.perf_event_paranoid above 2)
+    string open();
+    bool available(HardwareCounter counter) const {
+        return fds[counter] >= 0;
+    }
+    Reading read() const;
+    void add(Phase phase, const Reading &start) {
+        Reading end = read();
+        totals[phase].calls++;
+        totals[phase].sum.nanoseconds += end.nanoseconds - start.nanoseconds;
+        for (int counter = 0; counter < TOTAL_COUNTERS; counter++) {
+            totals[phase].sum.values[counter] += end.values[counter] - start.values[counter];
+        }
+    }
+    const Totals &total(Phase phase) const {
+        return totals[phase];
+    }
+    void reset() {
+        for (int phase = 0; phase < TOTAL_PHASES; phase++) totals[phase] = { 0, { 0, {} } };
+    }
+};
+
+// Only set by --bench counters, on the thread that runs the updates (see benchCounters())
+extern PerfCounters *perfCounters;
+
+
+class ScopedTimer {
+    // Adds how long it was alive to its phase (when profiling is on), to the trace (when recording one)
+    // and the hardware counts to perfCounters (when benchmarking them)
+private:
+    Phase phase;
+    bool timed;
+    bool traced;
+    int64_t start = 0;
+    PerfCounters *counters;
+    PerfCounters::Reading counted;
+public:
+    ScopedTimer(Phase phase) : phase(phase), timed(profiling), traced(tracing), counters(perfCounters) {
+        if (timed || traced) start = TraceRecorder::now();
+        if (counters) counted = counters->read();
+    }
+    ~ScopedTimer() {
+        if (counters) counters->add(phase, counted);
+        if (!timed && !traced) return;
+        int64_t end = TraceRecorder::now();
+        if (timed) phaseTimes.add(phase, (end - start) / 1e9);
+        if (traced) traceRecorder.record(phase, start, end);
+    }
+};
+
+class TraceSpan {
+    // Just the trace part of ScopedTimer, for an update thread's share of a phase
+    // (when the work runs inline, the caller's ScopedTimer already covers it)
+private:
+    Phase phase;
+    bool traced;
+    int64_t start = 0;
+public:
+    TraceSpan(Phase phase) : phase(phase), traced(tracing && traceLane >= TRACE_WORKERS) {
+        if (traced) start = TraceRecorder::now();
+    }
+    ~TraceSpan() {
+        if (traced) traceRecorder.record(phase, start, TraceRecorder::now());
+    }
+};
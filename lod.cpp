@@ -0,0 +1,92 @@
+#include <math.h>
+#include <algorithm>
+
+#include "instrumentation.h"
+#include "lod.h"
+
+
+void buildPyramid(const Simulation &simulation, LodPyramid &pyramid) {
+    const SimulationConfig &config = simulation.getConfig();
+    const CellVector &cells = simulation.getCells();
+    const int cellBounds = config.cellBounds;
+    pyramid.cellBounds = cellBounds;
+    for (int l = 0; l < LOD_LEVELS; l++) {
+        LodLevel &level = pyramid.levels[l];
+        level.blockSize = 2 << l;
+        level.blocksPerEdge = (cellBounds + level.blockSize - 1) / level.blockSize;
+        size_t blocks = (size_t)level.blocksPerEdge * level.blocksPerEdge * level.blocksPerEdge;
+        level.drawn.resize(blocks);
+        level.hpSum.resize(blocks);
+    }
+
+    // On the update threads: each one does the biggest blocks that start in its x slab, and every block under them,
+    // so no 2 threads add to the same block and each reads the cells it first touched (the slabs are whole tiles,
+    // so they already start on a block, the rounding is in case they ever don't)
+    const int top = 2 << (LOD_LEVELS - 1);
+    forEachUpdateThread(config, [&](size_t, int start, int end) {
+        TraceSpan span(PHASE_RENDER);
+        const int topStart = (start + top - 1) / top, topEnd = (end + top - 1) / top;
+        for (int l = 0; l < LOD_LEVELS; l++) {
+            LodLevel &level = pyramid.levels[l];
+            const int perTop = top / level.blockSize;
+            const int xStart = topStart * perTop, xEnd = std::min(topEnd * perTop, level.blocksPerEdge);
+            const size_t plane = (size_t)level.blocksPerEdge * level.blocksPerEdge;
+            std::fill(level.drawn.begin() + xStart * plane, level.drawn.begin() + xEnd * plane, 0);
+            std::fill(level.hpSum.begin() + xStart * plane, level.hpSum.begin() + xEnd * plane, 0);
+        }
+
+        LodLevel &first = pyramid.levels[0];
+        for (int x = topStart * top; x < std::min(topEnd * top, cellBounds); x++) {
+            for (int y = 0; y < cellBounds; y++) {
+                for (int z = 0; z < cellBounds; z++) {
+                    int hp = cells[threeToOne(x, y, z, cellBounds)].getHp();
+                    if (hp < 0) continue;
+                    size_t i = threeToOne(x / 2, y / 2, z / 2, first.blocksPerEdge);
+                    first.drawn[i]++;
+                    first.hpSum[i] += hp;
+                }
+            }
+        }
+        for (int l = 1; l < LOD_LEVELS; l++) {
+            // Each block is the 2^3 blocks under it
+            const LodLevel &below = pyramid.levels[l - 1];
+            LodLevel &level = pyramid.levels[l];
+            const int perTop = top / below.blockSize;
+            for (int x = topStart * perTop; x < std::min(topEnd * perTop, below.blocksPerEdge); x++) {
+                for (int y = 0; y < below.blocksPerEdge; y++) {
+                    for (int z = 0; z < below.blocksPerEdge; z++) {
+                        size_t from = threeToOne(x, y, z, below.blocksPerEdge);
+                        size_t i = threeToOne(x / 2, y / 2, z / 2, level.blocksPerEdge);
+                        level.drawn[i] += below.drawn[from];
+                        level.hpSum[i] += below.hpSum[from];
+                    }
+                }
+            }
+        }
+    });
+}
+
+CellBox blockCells(const LodLevel &level, int cellBounds, Vector3Int block) {
+    const int size = level.blockSize;
+    return {
+        { block.x * size, block.y * size, block.z * size },
+        { std::min((block.x + 1) * size, cellBounds), std::min((block.y + 1) * size, cellBounds), std::min((block.z + 1) * size, cellBounds) }
+    };
+}
+
+int lodLevel(const ViewCamera &camera, float viewHeight, Vector3Float min, Vector3Float max) {
+    // Something depth away is viewHeight / (2 * depth * tan(fovy / 2)) pixels per unit, so the nearest corner
+    // along the view direction is where the cells are the biggest
+    Vector3Float forward = normalize(camera.target - camera.position);
+    Vector3Float nearest = {
+        forward.x >= 0 ? min.x : max.x,
+        forward.y >= 0 ? min.y : max.y,
+        forward.z >= 0 ? min.z : max.z
+    };
+    float depth = dot(nearest - camera.position, forward);
+    if (depth <= CULL_NEAR) return 0;
+    float cellPixels = viewHeight / (2 * depth * tan(camera.fovy * 3.14159265358979323846f / 360.0f));
+    int level = 0;
+    while (level < LOD_LEVELS && cellPixels * (2 << level) <= LOD_PIXELS) level++;
+    return level;
+}
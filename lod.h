@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "culling.h"
+#include "simulation.h"
+
+using std::vector;
+
+
+#define LOD_LEVELS 2 // blocks of 2^3 and 4^3 cells (CHUNK_SIZE has to be a multiple of the biggest)
+// Cells are drawn as blocks when a block would be at most this many pixels across
+#define LOD_PIXELS 3.0f
+
+
+struct LodLevel {
+    // The cells in blocks of blockSize^3, the last block on each edge is cut off when cellBounds isn't a multiple of it
+    int blockSize;
+    int blocksPerEdge;
+    vector<uint16_t> drawn; // cells with hp >= 0
+    vector<uint32_t> hpSum; // of the drawn cells
+};
+
+struct LodPyramid {
+    // levels[0] is 2^3 blocks, and every level is counted from the one below it
+    int cellBounds = 0;
+    LodLevel levels[LOD_LEVELS];
+};
+
+
+// Counts the blocks again on the simulation's update threads (like buildRenderBuffer()), into the same memory
+// when the size didn't change
+void buildPyramid(const Simulation &simulation, LodPyramid &pyramid);
+CellBox blockCells(const LodLevel &level, int cellBounds, Vector3Int block);
+
+// How many levels up the cells between min and max can be drawn (0 = the cells themselves, up to LOD_LEVELS):
+// the biggest blocks that are still at most LOD_PIXELS across at the box's nearest depth, when the view is viewHeight pixels high
+int lodLevel(const ViewCamera &camera, float viewHeight, Vector3Float min, Vector3Float max);
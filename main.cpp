@@ -1,65 +1,46 @@
 #include "raylib.h"
 #include <math.h>
 #include <time.h>
-#include <vector>
-#include <thread>
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
-#include <fstream>
+#include <random>
+#include <sstream>
 
-#include "json.hpp"
-
-using std::string;
-using std::vector;
-using std::thread;
-
-using json = nlohmann::json;
+#include "culling.h"
+#include "headless.h"
+#include "instrumentation.h"
+#include "lod.h"
+#include "options.h"
+#include "producer.h"
+#include "render.h"
+#include "simulation.h"
 
 
 #define PI 3.14159265358979323846f
 
-#define JSON_FILE "options.json"
-
-
-enum NeighborType {
-    MOORE,
-    VON_NEUMANN
-};
 
-enum DrawMode {
-    DUAL_COLOR = 0,
-    RGB_CUBE = 1,
-    DUAL_COLOR_DYING = 2,
-    SINGLE_COLOR = 3,
-    CENTER_DIST = 4
+struct WallLayout {
+    // The grid of thumbnails when more than 1 simulation is run (see the simulations option)
+    int columns;
+    int rows;
+    int width;
+    int height;
 };
 
-enum TickMode {
-    FAST = 0,
-    DYNAMIC = 1,
-    MANUAL = 2
+struct ClipView {
+    // What of the cells is drawn: the slabs cut by the clip planes from the options (the cross section is the first half
+    // of x on top of that), or with the slice view just the cells the slice plane goes through, flat
+    CellBox slabs;
+    vector<ClipPlane> planes;
+    bool showHalf;
+    bool slicing;
+    ClipPlane slice;
 };
 
 
-struct Vector3Int {
-    int x, y, z;
-};
+Palette palette;
 
-bool SURVIVAL[27];
-bool SPAWN[27];
-int STATE;
-NeighborType NEIGHBORHOODS;
-
-Color dualColorAlive;
-Color dualColorDead;
-Vector3 colorOffset;
-Color dualColorDyingAlive;
-Color singleColorAlive;
-Color centerDistMax;
-
-int cellBounds;
-size_t totalCells;
-float aliveChanceOnSpawn;
-size_t threads;
 int targetFPS;
 
 
@@ -74,8 +55,8 @@ public:
         }
         else if (!pressState) wasDown = false;
         return false;
-    } 
-    
+    }
+
 };
 
 
@@ -84,11 +65,11 @@ private:
     string text;
 public:
     DrawableText(string text) : text(text) {}
-    void draw(int i) const {
-        int x = 30;
+    void draw(int i, int left = 0) const {
+        int x = left + 30;
         Color color = DARKGRAY;
         if (text[0] != '-') {
-            x = 20;
+            x = left + 20;
             color = BLACK;
         }
         DrawText(text.c_str(), x, (i + 1) * 14, 10, color);
@@ -99,133 +80,10 @@ public:
 };
 
 
-float calc_distance(Vector3Int a, Vector3Int b) {
-    return sqrt(pow((float)a.x - b.x, 2) + pow((float)a.y - b.y, 2) + pow((float)a.z - b.z, 2));
+float degreesToRadians(float degrees) {
+    return degrees * PI / 180.0f;
 }
 
-
-class Cell {
-private:
-    Vector3 pos;
-    Vector3Int index;
-    int hp = -1;
-    size_t neighbors = 0;
-    static int aliveCells;
-    static int deadCells;
-
-    void draw(Color color) const { DrawCube(pos, 1.0f, 1.0f, 1.0f, color); }
-
-public:
-    Cell(Vector3Int index) {
-        this->index = index;
-        pos = {
-            index.x - (cellBounds - 1.0f) / 2,
-            index.y - (cellBounds - 1.0f) / 2,
-            index.z - (cellBounds - 1.0f) / 2
-        };
-    }
-
-    static void clearCellCounts() {
-        aliveCells = 1;
-        deadCells = 1;
-    }
-    static int getAliveCells() { return aliveCells; }
-    static int getDeadCells() { return deadCells; }
-
-    void clearNeighbors() { neighbors = 0; }
-    void addNeighbor(int neighborAlive) { neighbors += neighborAlive; }
-    int getHp() const { return hp; }
-    void setHp(int hp) { this->hp = hp; }
-    bool getAlive() const { return hp == STATE; }
-    void reset() {
-        hp = -1;
-        neighbors = 0;
-    }
-    void randomizeState() {
-        hp = ((double)rand() / (double)RAND_MAX < aliveChanceOnSpawn) * (STATE + 1) - 1;
-    }
-    void sync() {
-        // Branchless by using bool -> int conversion
-        hp = 
-            (hp == STATE) * (hp - 1 + SURVIVAL[neighbors]) + // alive
-            (hp < 0) * (SPAWN[neighbors] * (STATE + 1) - 1) +  // dead
-            (hp >= 0 && hp < STATE) * (hp - 1); // dying
-
-        aliveCells += hp == STATE;
-        deadCells += hp < 0;
-    }
-    void jsonStateUpdate(int oldState) {
-        hp = 
-            (hp < 0) * -1 + // stay dead
-            (hp >= 0) * (hp * (float)STATE/oldState); // scale hp
-    }
-    void drawDualColor() const {
-        if (hp >= 0) {
-            draw((Color){
-                (unsigned char)(dualColorDead.r + colorOffset.x/(STATE + 1) * (hp + 1)),
-                (unsigned char)(dualColorDead.g + colorOffset.y/(STATE + 1) * (hp + 1)),
-                (unsigned char)(dualColorDead.b + colorOffset.z/(STATE + 1) * (hp + 1)),
-                255
-            });
-        }
-    }
-    void drawRGBCube() const {
-        if (hp >= 0) {
-            draw((Color){
-                (unsigned char)((float)index.x/cellBounds * 255),
-                (unsigned char)((float)index.y/cellBounds * 255),
-                (unsigned char)((float)index.z/cellBounds * 255),
-                255
-            });
-        }
-    }
-    void drawDualColorDying() const {
-        if (hp >= 0) {
-            Color color = dualColorDyingAlive;
-            if (hp < STATE) {
-                float intensity = (1.0f + hp)/(STATE + 2.0f);
-                unsigned char brightness = (int)(intensity * 255);
-                color = (Color){ brightness, brightness, brightness, 255 };
-            }
-            draw(color);
-        }
-    }
-    void drawSingleColor() const {
-        if (hp >= 0) {
-            float intensity = 3.0f/(STATE + 3.0f) + hp/(STATE + 3.0f);
-            draw((Color){
-                (unsigned char)(intensity * singleColorAlive.r),
-                (unsigned char)(intensity * singleColorAlive.g),
-                (unsigned char)(intensity * singleColorAlive.b),
-                255
-            });
-        }
-    }
-    void drawDist() const {
-        if (hp >= 0) {
-            int cap = cellBounds/2;
-            float dist = calc_distance(index, { cap, cap, cap });
-            float intensity = 2.0f/(cap * sqrt(3.0f) + 2.0f) + dist/(cap * sqrt(3.0f) + 2.0f);
-            draw((Color){
-                (unsigned char)(intensity * centerDistMax.r),
-                (unsigned char)(intensity * centerDistMax.g),
-                (unsigned char)(intensity * centerDistMax.b),
-                255
-            });
-        }
-    }
-};
-int Cell::aliveCells = 1;
-int Cell::deadCells = 1;
-
-
-string textFromEnum(NeighborType nt) {
-    switch (nt) {
-        case MOORE: return "Moore";
-        case VON_NEUMANN: return "von Neumann";
-    }
-    return "";
-}
 string textFromEnum(DrawMode dm) {
     switch (dm) {
         case DUAL_COLOR: return "Dual Color";
@@ -236,248 +94,185 @@ string textFromEnum(DrawMode dm) {
     }
     return "";
 }
-string textFromEnum(TickMode tm) {
-    switch (tm) {
-        case MANUAL: return "Manual";
-        case FAST: return "Fastest";
-        case DYNAMIC: return "Dynamic";
-    }
-    return "";
-}
 
-void loadFromJSON() {
-    std::cout << "Loading from JSON..." << std::endl;
+
+Options loadFromJSON(const CommandLine &command) {
+    // The simulation's options (see loadOptions), plus the ones only the viewer uses
     try {
-        json rules;
-        std::ifstream reader(JSON_FILE);
-        reader >> rules;
-        reader.close();
-
-        for (size_t i = 0; i < 27; i++) SURVIVAL[i] = false;
-        for (size_t i = 0; i < 27; i++) SPAWN[i] = false;
-
-        for (size_t value : rules["survival"]) SURVIVAL[value] = true;
-        for (size_t value : rules["spawn"]) SPAWN[value] = true;
-
-        STATE = rules["state"];
-        if (rules["neighborhood"] == "VN") NEIGHBORHOODS = VON_NEUMANN;
-        else NEIGHBORHOODS = MOORE;
-
-        dualColorAlive = {
-            rules["dualColorAlive"][0],
-            rules["dualColorAlive"][1],
-            rules["dualColorAlive"][2],
-            255
-        };
-        dualColorDead = {
-            rules["dualColorDead"][0],
-            rules["dualColorDead"][1],
-            rules["dualColorDead"][2],
-            255
-        };
-        colorOffset = {
-            (float)(dualColorAlive.r - dualColorDead.r),
-            (float)(dualColorAlive.g - dualColorDead.g),
-            (float)(dualColorAlive.b - dualColorDead.b)
-        };
-        dualColorDyingAlive = {
-            rules["dualColorDyingAlive"][0],
-            rules["dualColorDyingAlive"][1],
-            rules["dualColorDyingAlive"][2],
-            255
-        };
-        singleColorAlive = {
-            rules["singleColorAlive"][0],
-            rules["singleColorAlive"][1],
-            rules["singleColorAlive"][2],
-            255
-        };
-        centerDistMax = {
-            rules["centerDistMax"][0],
-            rules["centerDistMax"][1],
-            rules["centerDistMax"][2],
-            255
+        Options options = loadOptions(command.optionsFile, command.overrides);
+        const json &rules = options.values;
+
+        auto color = [&](const string &key) {
+            return (InstanceColor){ rules.at(key).at(0), rules.at(key).at(1), rules.at(key).at(2), 255 };
         };
-        
-        cellBounds = rules["cellBounds"];
-        totalCells = cellBounds * cellBounds * cellBounds;
-        aliveChanceOnSpawn = rules["aliveChanceOnSpawn"];
-        threads = rules["threads"];
-        targetFPS = rules["targetFPS"];
-
-        std::cout << "Finished loading from JSON..." << std::endl;
+        palette.dualColorAlive = color("dualColorAlive");
+        palette.dualColorDead = color("dualColorDead");
+        palette.dualColorDyingAlive = color("dualColorDyingAlive");
+        palette.singleColorAlive = color("singleColorAlive");
+        palette.centerDistMax = color("centerDistMax");
+        targetFPS = rules.at("targetFPS");
+        profiling = options.profile;
+        return options;
     }
     catch (std::exception& e) {
         std::cout << "Error: " << e.what() << std::endl;
-        std::cout << "JSON '" << JSON_FILE << "' not found or invalid." << std::endl;
+        std::cout << "JSON '" << command.optionsFile << "' not found or invalid." << std::endl;
         std::cout << "Exiting..." << std::endl;
         exit(EXIT_FAILURE);
     }
 }
 
-float degreesToRadians(float degrees) {
-    return degrees * PI / 180.0f;
-}
-
-size_t threeToOne(int x, int y, int z) {
-    return x * cellBounds * cellBounds + y * cellBounds  + z;
-}
-
-
-bool validCellIndex(int x, int y, int z, const Vector3Int &offset) {
-    return x + offset.x >= 0 && x + offset.x < cellBounds &&
-           y + offset.y >= 0 && y + offset.y < cellBounds &&
-           z + offset.z >= 0 && z + offset.z < cellBounds;
-}
 
-void syncCells(vector<Cell> &cells, size_t start, size_t end) {
-    for (size_t i = start; i < end; i++) {
-        cells[i].sync();
-    }
+Color toColor(InstanceColor color) {
+    return (Color){ color.r, color.g, color.b, color.a };
 }
 
-void updateNeighbors(vector<Cell> &cells, int start, int end, const Vector3Int offsets[], size_t totalOffsets) {
-    for (int x = start; x < end; x++) {
-        for (int y = 0; y < cellBounds; y++) {
-            for (int z = 0; z < cellBounds; z++) {
-                int oneIdx = threeToOne(x, y, z);
-                cells[oneIdx].clearNeighbors();
-                for (size_t i = 0; i < totalOffsets; i++) {
-                    if (validCellIndex(x, y, z, offsets[i])) {
-                        cells[oneIdx].addNeighbor(cells[threeToOne(x + offsets[i].x, y + offsets[i].y, z + offsets[i].z)].getAlive());
-                    }
-                }
+void drawBlocks(const LodLevel &level, const ChunkGrid &grid, int chunk, DrawMode drawMode, int state, CullStats &stats) {
+    // 1 cube per block of the chunk instead of 1 per cell, colored by the mean hp of its drawn cells and faded
+    // into the background by how much of it is empty (a block is what a few pixels of those cells would average to)
+    const int bounds = grid.cellBounds;
+    CellBox part = chunkCells(grid, chunk);
+    const int size = level.blockSize;
+    for (int x = part.min.x / size; x * size < part.max.x; x++) {
+        for (int y = part.min.y / size; y * size < part.max.y; y++) {
+            for (int z = part.min.z / size; z * size < part.max.z; z++) {
+                size_t i = threeToOne(x, y, z, level.blocksPerEdge);
+                int drawn = level.drawn[i];
+                if (drawn == 0) continue;
+                CellBox block = blockCells(level, bounds, { x, y, z });
+                Vector3Float min = cellCorner(block.min, bounds);
+                Vector3Float max = cellCorner(block.max, bounds);
+                Vector3Float extent = max - min;
+                Vector3Float index = {
+                    (block.min.x + block.max.x - 1) / 2.0f,
+                    (block.min.y + block.max.y - 1) / 2.0f,
+                    (block.min.z + block.max.z - 1) / 2.0f
+                };
+                int hp = (int)round(level.hpSum[i] / (float)drawn);
+                Color color = toColor(cellColor(palette, drawMode, hp, index, bounds, state));
+                float filled = drawn / (extent.x * extent.y * extent.z);
+                color.r = (unsigned char)(RAYWHITE.r + (color.r - RAYWHITE.r) * filled);
+                color.g = (unsigned char)(RAYWHITE.g + (color.g - RAYWHITE.g) * filled);
+                color.b = (unsigned char)(RAYWHITE.b + (color.b - RAYWHITE.b) * filled);
+
+                Vector3Float center = (min + max) * 0.5f;
+                DrawCube((Vector3){ center.x, center.y, center.z }, extent.x, extent.y, extent.z, color);
+                stats.blocks++;
+                stats.blockCells += drawn;
             }
         }
     }
 }
 
-void updateCells(vector<Cell> &cells) {
-    Vector3Int offsets[26];
-    size_t totalOffsets;
-    Cell::clearCellCounts();
-    if (NEIGHBORHOODS == MOORE) {
-        // I don't know how to set array to a different array
-        offsets[0] = { -1, -1, -1 };
-        offsets[1] = { -1, -1, 0 };
-        offsets[2] = { -1, -1, 1 };
-        offsets[3] = { -1, 0, -1 };
-        offsets[4] = { -1, 0, 0 };
-        offsets[5] = { -1, 0, 1 };
-        offsets[6] = { -1, 1, -1 };
-        offsets[7] = { -1, 1, 0 };
-        offsets[8] = { -1, 1, 1 };
-        offsets[9] = { 0, -1, -1 };
-        offsets[10] = { 0, -1, 0 };
-        offsets[11] = { 0, -1, 1 };
-        offsets[12] = { 0, 0, -1 };
-        offsets[13] = { 0, 0, 1 };
-        offsets[14] = { 0, 1, -1 };
-        offsets[15] = { 0, 1, 0 };
-        offsets[16] = { 0, 1, 1 };
-        offsets[17] = { 1, -1, -1 };
-        offsets[18] = { 1, -1, 0 };
-        offsets[19] = { 1, -1, 1 };
-        offsets[20] = { 1, 0, -1 };
-        offsets[21] = { 1, 0, 0 };
-        offsets[22] = { 1, 0, 1 };
-        offsets[23] = { 1, 1, -1 };
-        offsets[24] = { 1, 1, 0 };
-        offsets[25] = { 1, 1, 1 };
-        totalOffsets = 26;
-    }
-    else {
-        offsets[0] = { 1, 0, 0 };
-        offsets[1] = { -1, 0, 0 };
-        offsets[2] = { 0, 1, 0 };
-        offsets[3] = { 0, -1, 0 };
-        offsets[4] = { 0, 0, 1 };
-        offsets[5] = { 0, 0, -1 };
-        totalOffsets = 6;
+void drawInstances(const RenderBuffer &buffer, const ChunkGrid &grid, int chunk) {
+    // The chunk's cubes straight from the render buffer, only a chunk the slabs or clip planes cut into has to check them
+    bool whole = chunkWhole(grid, chunk);
+    for (size_t i = buffer.chunkStart[chunk]; i < buffer.chunkStart[chunk + 1]; i++) {
+        if (!whole && !cellInside(grid, instanceIndex(buffer, i))) continue;
+        const Vector3Float &position = buffer.positions[i];
+        DrawCube((Vector3){ position.x, position.y, position.z }, 1.0f, 1.0f, 1.0f, toColor(buffer.colors[i]));
     }
+}
 
-    thread neighborThreads[threads];
-    for (size_t i = 0; i < threads; i++) {
-        int start = i * cellBounds / threads;
-        int end = (i + 1) * cellBounds / threads;
-        neighborThreads[i] = thread(updateNeighbors, std::ref(cells), start, end, offsets, totalOffsets);
-    }
-    for (size_t i = 0; i < threads; i++) {
-        neighborThreads[i].join();
+void drawCells(
+    Generation &shown,
+    const CellBox &box,
+    const vector<ClipPlane> &planes,
+    const ViewCamera &view,
+    float viewHeight,
+    bool culling,
+    bool lod,
+    DrawMode drawMode,
+    CullStats &stats
+) {
+    // The generation's render buffer was made by the simulation thread, unless the draw mode changed since
+    RenderBuffer &buffer = shown.render;
+    if (buffer.drawMode != drawMode) recolorRenderBuffer(buffer, drawMode, palette);
+    const int cellBounds = buffer.cellBounds;
+    ChunkGrid grid = countChunks(buffer, box, planes);
+    vector<int> chunks;
+    if (culling) chunks = visibleChunks(grid, view, stats);
+    else {
+        for (size_t i = 0; i < grid.drawn.size(); i++) {
+            if (grid.drawn[i] == 0) continue;
+            chunks.push_back((int)i);
+            stats.chunks++;
+            stats.drawnCells += grid.drawn[i];
+        }
     }
 
-    thread syncThreads[threads];
-    for (size_t i = 0; i < threads; i++) {
-        size_t start = i * totalCells / threads;
-        size_t end = (i + 1) * totalCells / threads;
-        syncThreads[i] = thread(syncCells, std::ref(cells), start, end);
-    }
-    for (size_t i = 0; i < threads; i++) {
-        syncThreads[i].join();
+    // Far away chunks are drawn as blocks instead (see lod.h), except where the slabs or clip planes cut into them
+    const LodPyramid &pyramid = shown.lod;
+    for (int chunk : chunks) {
+        int level = 0;
+        if (lod && pyramid.cellBounds == cellBounds && chunkWhole(grid, chunk)) {
+            CellBox part = chunkCells(grid, chunk);
+            level = lodLevel(view, viewHeight, cellCorner(part.min, cellBounds), cellCorner(part.max, cellBounds));
+        }
+        if (level == 0) drawInstances(buffer, grid, chunk);
+        else drawBlocks(pyramid.levels[level - 1], grid, chunk, drawMode, buffer.state, stats);
     }
 }
 
-
-void drawCells(const vector<Cell> &cells, int divisor, DrawMode drawMode) {
-    // A bit exessive to put this on the outside, but is saves doing cellBounds^3
-    // extra checks at the cost of extra code
-    switch (drawMode) {
-        case DUAL_COLOR:
-            for (int x = 0; x < cellBounds/divisor; x++) {
-                for (int y = 0; y < cellBounds; y++) {
-                    for (int z = 0; z < cellBounds; z++) {
-                        cells[threeToOne(x, y, z)].drawDualColor();
-                    }
-                }
-            }
-            break;
-        case RGB_CUBE:
-            for (int x = 0; x < cellBounds/divisor; x++) {
-                for (int y = 0; y < cellBounds; y++) {
-                    for (int z = 0; z < cellBounds; z++) {
-                        cells[threeToOne(x, y, z)].drawRGBCube();
-                    }
-                }
-            }
-            break;
-        case DUAL_COLOR_DYING:
-            for (int x = 0; x < cellBounds/divisor; x++) {
-                for (int y = 0; y < cellBounds; y++) {
-                    for (int z = 0; z < cellBounds; z++) {
-                        cells[threeToOne(x, y, z)].drawDualColorDying();
-                    }
-                }
-            }
-            break;
-        case SINGLE_COLOR:
-            for (int x = 0; x < cellBounds/divisor; x++) {
-                for (int y = 0; y < cellBounds; y++) {
-                    for (int z = 0; z < cellBounds; z++) {
-                        cells[threeToOne(x, y, z)].drawSingleColor();
-                    }
-                }
-            }
-            break;
-        case CENTER_DIST:
-            for (int x = 0; x < cellBounds/divisor; x++) {
-                for (int y = 0; y < cellBounds; y++) {
-                    for (int z = 0; z < cellBounds; z++) {
-                        cells[threeToOne(x, y, z)].drawDist();
-                    }
-                }
-            }
-            break;
+void drawSlice(
+    Generation &shown,
+    const CellBox &box,
+    const ClipView &clip,
+    int viewWidth,
+    int viewHeight,
+    bool drawBounds,
+    DrawMode drawMode,
+    CullStats &stats
+) {
+    // The cells the slice plane goes through as squares, looking at it from the side its normal points to
+    RenderBuffer &buffer = shown.render;
+    if (buffer.drawMode != drawMode) recolorRenderBuffer(buffer, drawMode, palette);
+    const int cellBounds = buffer.cellBounds;
+    ChunkGrid grid = makeChunkGrid(cellBounds, box, clip.planes);
+    vector<size_t> slice = sliceInstances(buffer, grid, clip.slice, stats);
+
+    // u goes right and v up along the plane (z is up unless the plane faces up or down), scaled so the bounds fit
+    const Vector3Float &normal = clip.slice.normal;
+    Vector3Float u = normalize(cross(fabs(normal.z) < 0.9f ? Vector3Float{ 0, 0, 1 } : Vector3Float{ 0, 1, 0 }, normal));
+    Vector3Float v = cross(normal, u);
+    float uExtent = 0, vExtent = 0;
+    for (int i = 0; i < 8; i++) {
+        Vector3Float corner = cellCorner({ i & 1 ? cellBounds : 0, i & 2 ? cellBounds : 0, i & 4 ? cellBounds : 0 }, cellBounds);
+        uExtent = std::max(uExtent, fabs(dot(corner, u)));
+        vExtent = std::max(vExtent, fabs(dot(corner, v)));
+    }
+    float scale = 0.9f * std::min(viewWidth / (2 * uExtent), viewHeight / (2 * vExtent));
+    int size = std::max(1, (int)ceil(scale));
+    for (size_t i : slice) {
+        const Vector3Float &position = buffer.positions[i];
+        float x = viewWidth / 2.0f + dot(position, u) * scale;
+        float y = viewHeight / 2.0f - dot(position, v) * scale;
+        DrawRectangle((int)(x - scale / 2), (int)(y - scale / 2), size, size, toColor(buffer.colors[i]));
+    }
+
+    if (drawBounds) {
+        DrawRectangleLines((int)(viewWidth / 2.0f - uExtent * scale), (int)(viewHeight / 2.0f - vExtent * scale),
+            (int)(2 * uExtent * scale), (int)(2 * vExtent * scale), BLUE);
     }
 }
 
 void drawLeftBar(
+    const SimulationConfig &config,
+    size_t simulationCount,
+    size_t focused,
+    size_t workers,
+    bool showWall,
     bool drawBounds,
-    bool showHalf,
+    const ClipView &clip,
+    bool culling,
+    bool lod,
     bool paused,
     DrawMode drawMode,
     TickMode tickMode,
-    int updateSpeed,
-    int ticks,
+    int ticksPerSecond,
+    int allTicksPerSecond,
+    const Generation &shown,
+    const CullStats &culled,
     float growthRate,
     float deathRate,
     float cameraLat,
@@ -488,16 +283,30 @@ void drawLeftBar(
         (cameraLat > 0 ? 'N' : 'S'),
         (cameraLon > 0 ? 'W' : 'E')
     };
+    const RuleSet &rules = config.rules;
 
-    string survivalText = "- Survival:";
-    for (size_t i = 0; i < 27; i++) {
-        if (SURVIVAL[i]) survivalText += " " + std::to_string(i);
-    }
+    string survivalText = "- Survival: " + numberListToString(rules.survival);
 
-    string spawnText = "- Spawn:";
-    for (size_t i = 0; i < 27; i++) {
-        if (SPAWN[i]) spawnText += " " + std::to_string(i);
+    string cycleText = "- Cycle: none detected";
+    if (shown.period == 1) cycleText = "- Cycle: steady since tick " + std::to_string(shown.cycleStart);
+    else if (shown.period > 1) {
+        cycleText = "- Cycle: period " + std::to_string(shown.period) + " since tick " + std::to_string(shown.cycleStart);
     }
+    if (shown.replaying) cycleText += " (replaying)";
+
+    string spawnText = "- Spawn: " + numberListToString(rules.spawn);
+
+    const CellBox &slabs = clip.slabs;
+    string clipText = "- Slabs: x " + std::to_string(slabs.min.x) + "-" + std::to_string(slabs.max.x - 1) +
+        ", y " + std::to_string(slabs.min.y) + "-" + std::to_string(slabs.max.y - 1) +
+        ", z " + std::to_string(slabs.min.z) + "-" + std::to_string(slabs.max.z - 1) + " (" + std::to_string(clip.planes.size()) + " clip planes)";
+
+    // With a wall of simulations, the info is about the focused one (outlined in red)
+    bool wall = simulationCount > 1;
+    string ticksText = "- Ticks per sec: " + std::to_string(ticksPerSecond);
+    if (wall) ticksText += " (all: " + std::to_string(allTicksPerSecond) + ")";
+    string threadsText = "- Threads: " + std::to_string(config.threads) + " (+ 2)";
+    if (wall) threadsText = "- Workers: " + std::to_string(workers) + " shared by " + std::to_string(simulationCount) + " simulations (+ 1)";
 
     const DrawableText dts[] = {
         DrawableText("Controls:"),
@@ -507,7 +316,11 @@ void drawLeftBar(
         DrawableText("- R : re-randomize cells"),
         DrawableText("- B : show/hide bounds " + (string)(drawBounds ? "(on)" : "(off)")),
         DrawableText("- P : show/hide this bar (on)"),
-        DrawableText("- C : toggle cross section view " + (string)(showHalf ? "(on)" : "(off)")),
+        DrawableText("- C : toggle cross section view " + (string)(clip.showHalf ? "(on)" : "(off)")),
+        DrawableText("- F : toggle slice view " + (string)(clip.slicing ? "(on)" : "(off)")),
+        (clip.slicing ? DrawableText("- [/] : move the slice plane back/forward") : DrawableText("")),
+        DrawableText("- K : toggle chunk culling " + (string)(culling ? "(on)" : "(off)")),
+        DrawableText("- V : toggle level of detail " + (string)(lod ? "(on)" : "(off)")),
         DrawableText("- Mouse click : pause/unpause " + (string)(paused ? "(paused)" : "(running)")),
         DrawableText("- Space : reset camera"),
         DrawableText("- Enter : toggle fullscreen"),
@@ -515,24 +328,37 @@ void drawLeftBar(
         DrawableText("- O : toggle true fullscreen (not reccomended)"),
         DrawableText("- M : change between draw modes [" + textFromEnum(drawMode) + "]"),
         DrawableText("- U : change between tick modes [" + textFromEnum(tickMode) + "]"),
+        DrawableText("- T : show/hide phase timings " + (string)(profiling ? "(on)" : "(off)")),
+        DrawableText("- L : start/stop recording a trace " + (string)(tracing ? "(recording)" : "(off)")),
         (tickMode == MANUAL ? DrawableText("- X/Z : increase/decrease tick speed") : DrawableText("")),
+        (wall ? DrawableText("- G : show the wall/the focused simulation " + (string)(showWall ? "(wall)" : "(focused)")) : DrawableText("")),
+        (wall ? DrawableText("- N : focus the next simulation (" + std::to_string(focused + 1) + "/" + std::to_string(simulationCount) + ")") : DrawableText("")),
 
         DrawableText("Simulation Info:"),
         DrawableText("- FPS: " + std::to_string(GetFPS())),
-        DrawableText("- Ticks per sec: " + std::to_string(tickMode == FAST ? GetFPS() : updateSpeed)),
-        DrawableText("- Total ticks ('time'): " + std::to_string(ticks)),
-        DrawableText("- Total alive cells: " + std::to_string(Cell::getAliveCells())),
+        DrawableText(ticksText),
+        DrawableText("- Total ticks ('time'): " + std::to_string(shown.ticks)),
+        DrawableText("- Total alive cells: " + std::to_string(shown.stats.aliveCells)),
         DrawableText("- Growth Rate: " + std::to_string((int)((growthRate - 1.0f) * 100)) + "%"),
         DrawableText("- Death Rate: " + std::to_string((int)((deathRate - 1.0f) * 100)) + "%"),
-        DrawableText("- Bound size: " + std::to_string(cellBounds)),
-        DrawableText("- Threads: " + std::to_string(threads) + " (+ 2)"),
+        DrawableText(cycleText),
+        (clip.slicing ?
+            DrawableText("- Drawn cells: " + std::to_string(culled.drawnCells) + " (the slice goes through " +
+                std::to_string(culled.sliceChunks) + " of " + std::to_string(culled.chunks) + " chunks)") :
+            DrawableText("- Drawn cells: " + std::to_string(culled.drawnCells) + " (" + std::to_string(culled.frustumCulled) + " + " +
+                std::to_string(culled.occluded) + " of " + std::to_string(culled.chunks) + " chunks culled)")),
+        DrawableText(clipText),
+        DrawableText("- Level of detail: " + std::to_string(culled.blocks) + " blocks for " + std::to_string(culled.blockCells) + " of them"),
+        DrawableText("- Bound size: " + std::to_string(config.cellBounds)),
+        DrawableText(threadsText),
         DrawableText("- Camera pos: " + std::to_string((int)abs(cameraLat)) + dirs[0] + ", " + std::to_string(abs((int)cameraLon)) + dirs[1]),
 
-        DrawableText("Rules:"),
+        DrawableText("Rules: " + ruleToString(rules)),
         DrawableText(survivalText),
         DrawableText(spawnText),
-        DrawableText("- State: " + std::to_string(STATE)),
-        DrawableText("- Neighborhood: " + textFromEnum(NEIGHBORHOODS)),
+        DrawableText("- State: " + std::to_string(rules.state)),
+        DrawableText("- Neighborhood: " + textFromEnum(rules.neighborhood) + " (radius " + std::to_string(rules.radius) + ", " + std::to_string(rules.offsets.size()) + " neighbors)"),
+        DrawableText("- Boundary: " + textFromEnum(rules.boundary)),
     };
 
     const size_t lenTexts = sizeof(dts) / sizeof(dts[0]);
@@ -545,73 +371,255 @@ void drawLeftBar(
     }
 }
 
+void drawPhaseBar() {
+    // The right side version of the left bar, while profiling
+    auto milliseconds = [](double seconds) {
+        std::stringstream text;
+        text << std::fixed << std::setprecision(2) << seconds * 1000;
+        return text.str();
+    };
+    vector<DrawableText> dts;
+    dts.push_back(DrawableText("Phase timings (ms, last " + std::to_string(PHASE_SAMPLES) + "):"));
+    dts.push_back(DrawableText("- phase: average / p50 / p95"));
+    dts.push_back(DrawableText("- (count and sync: all update threads)"));
+    for (int phase = 0; phase < TOTAL_PHASES; phase++) {
+        PhaseTimes::Summary times = phaseTimes.summary((Phase)phase);
+        if (times.samples == 0) continue;
+        dts.push_back(DrawableText("- " + textFromEnum((Phase)phase) + ": " + milliseconds(times.average) + " / " +
+            milliseconds(times.p50) + " / " + milliseconds(times.p95)));
+    }
+
+    int left = GetScreenWidth() - 310;
+    DrawRectangle(left + 10, 10, 290, dts.size() * 14 + 7, Fade(SKYBLUE, 0.5f));
+    DrawRectangleLines(left + 10, 10, 290, dts.size() * 14 + 7, BLUE);
+    for (size_t i = 0; i < dts.size(); i++) {
+        dts[i].draw(i, left);
+    }
+}
+
+void drawScene(
+    Camera3D camera,
+    int viewWidth,
+    int viewHeight,
+    const Simulation &simulation,
+    Generation &shown,
+    bool drawBounds,
+    const ClipView &clip,
+    bool culling,
+    bool lod,
+    DrawMode drawMode,
+    CullStats &stats
+) {
+    const int cellBounds = simulation.getConfig().cellBounds;
+    // The cross section is the first half of x (of what the slabs leave)
+    CellBox box = clip.slabs;
+    if (clip.showHalf) box.max.x = std::max(box.min.x, std::min(box.max.x, cellBounds / 2));
+    if (clip.slicing) {
+        ScopedTimer timer(PHASE_DRAW_CELLS);
+        drawSlice(shown, box, clip, viewWidth, viewHeight, drawBounds, drawMode, stats);
+        return;
+    }
+    ViewCamera view = {
+        { camera.position.x, camera.position.y, camera.position.z },
+        { camera.target.x, camera.target.y, camera.target.z },
+        { camera.up.x, camera.up.y, camera.up.z },
+        camera.fovy,
+        viewWidth / (float)viewHeight
+    };
+    BeginMode3D(camera);
+        {
+            ScopedTimer timer(PHASE_DRAW_CELLS);
+            drawCells(shown, box, clip.planes, view, viewHeight, culling, lod, drawMode, stats);
+        }
+
+        if (drawBounds) {
+            // Around the box the cells are drawn in (the clip planes aren't shown)
+            Vector3Float min = cellCorner(box.min, cellBounds), max = cellCorner(box.max, cellBounds);
+            Vector3Float center = (min + max) * 0.5f;
+            DrawCubeWires((Vector3){ center.x, center.y, center.z }, max.x - min.x, max.y - min.y, max.z - min.z, BLUE);
+        }
+    EndMode3D();
+}
+
+WallLayout wallLayout(size_t count) {
+    WallLayout wall;
+    wall.columns = (int)ceil(sqrt((double)count));
+    wall.rows = ((int)count + wall.columns - 1) / wall.columns;
+    wall.width = GetScreenWidth() / wall.columns;
+    wall.height = GetScreenHeight() / wall.rows;
+    return wall;
+}
+
+void fitThumbnails(vector<RenderTexture2D> &thumbnails, size_t count) {
+    // Made again when the window is resized or the number of simulations changed (after a reload)
+    WallLayout wall = wallLayout(count);
+    if (thumbnails.size() == count && thumbnails[0].texture.width == wall.width && thumbnails[0].texture.height == wall.height) return;
+    for (RenderTexture2D &thumbnail : thumbnails) UnloadRenderTexture(thumbnail);
+    thumbnails.clear();
+    for (size_t i = 0; i < count; i++) thumbnails.push_back(LoadRenderTexture(wall.width, wall.height));
+}
+
+void drawThumbnails(
+    Camera3D camera,
+    const vector<Simulation> &simulations,
+    const vector<Generation *> &shown,
+    vector<RenderTexture2D> &thumbnails,
+    bool drawBounds,
+    const ClipView &clip,
+    bool culling,
+    bool lod,
+    DrawMode drawMode,
+    CullStats &stats
+) {
+    // Every simulation is drawn into its own texture, has to be done before BeginDrawing()
+    fitThumbnails(thumbnails, simulations.size());
+    WallLayout wall = wallLayout(simulations.size());
+    for (size_t i = 0; i < simulations.size(); i++) {
+        BeginTextureMode(thumbnails[i]);
+            ClearBackground(RAYWHITE);
+            drawScene(camera, wall.width, wall.height, simulations[i], *shown[i], drawBounds, clip, culling, lod, drawMode, stats);
+        EndTextureMode();
+    }
+}
+
+void drawWall(const vector<Simulation> &simulations, const vector<Generation *> &shown, const vector<RenderTexture2D> &thumbnails, size_t focused) {
+    // The thumbnails laid out in a grid with a label each, the focused one is outlined in red
+    WallLayout wall = wallLayout(simulations.size());
+    for (size_t i = 0; i < simulations.size(); i++) {
+        int x = (int)(i % wall.columns) * wall.width;
+        int y = (int)(i / wall.columns) * wall.height;
+        // Render textures are upside down in OpenGL, so the source is flipped with a negative height
+        Texture2D texture = thumbnails[i].texture;
+        DrawTextureRec(texture, (Rectangle){ 0, 0, (float)texture.width, -(float)texture.height }, (Vector2){ (float)x, (float)y }, WHITE);
+
+        string label = ruleToString(simulations[i].getConfig().rules) + "  tick " + std::to_string(shown[i]->ticks) +
+            "  alive " + std::to_string(shown[i]->stats.aliveCells);
+        if (shown[i]->period > 0) label += "  period " + std::to_string(shown[i]->period);
+        DrawText(label.c_str(), x + 6, y + wall.height - 16, 10, BLACK);
+        DrawRectangleLines(x, y, wall.width, wall.height, i == focused ? RED : LIGHTGRAY);
+    }
+}
+
 void draw(
     Camera3D camera,
-    const vector<Cell> &cells,
+    const vector<Simulation> &simulations,
+    vector<RenderTexture2D> &thumbnails,
+    bool showWall,
+    size_t focused,
+    size_t workers,
     bool drawBounds,
     bool drawBar,
-    bool showHalf,
+    const ClipView &clip,
+    bool culling,
+    bool lod,
     bool paused,
     DrawMode drawMode,
     TickMode tickMode,
-    int updateSpeed, 
-    int ticks,
+    int ticksPerSecond,
+    int allTicksPerSecond,
+    const vector<Generation *> &shown,
     float growthRate,
     float deathRate,
     float cameraLat,
     float cameraLon)
  {
     // I know there are a lot of parameters, but this vastly cleans the main() function
+    const Simulation &simulation = simulations[focused];
+    // Added up over the thumbnails of the wall
+    CullStats stats;
+    if (showWall) drawThumbnails(camera, simulations, shown, thumbnails, drawBounds, clip, culling, lod, drawMode, stats);
     BeginDrawing();
         ClearBackground(RAYWHITE);
-        BeginMode3D(camera);
-            drawCells(cells, (int)showHalf + 1, drawMode);
-
-            if (drawBounds) {
-                if (showHalf) DrawCubeWires((Vector3){ -cellBounds/4.0f, 0, 0 }, cellBounds/2.0f, cellBounds, cellBounds, BLUE);
-                else DrawCubeWires((Vector3){ 0, 0, 0 }, cellBounds, cellBounds, cellBounds, BLUE);
+        if (showWall) drawWall(simulations, shown, thumbnails, focused);
+        else drawScene(camera, GetScreenWidth(), GetScreenHeight(), simulation, *shown[focused], drawBounds, clip, culling, lod, drawMode, stats);
+        {
+            ScopedTimer timer(PHASE_HUD);
+            if (drawBar) {
+                drawLeftBar(simulation.getConfig(), simulations.size(), focused, workers, showWall, drawBounds, clip, culling, lod, paused, drawMode, tickMode,
+                    ticksPerSecond, allTicksPerSecond, *shown[focused], stats, growthRate, deathRate, cameraLat, cameraLon);
             }
-        EndMode3D();
-        if (drawBar) {
-            drawLeftBar(drawBounds, showHalf, paused, drawMode, tickMode, updateSpeed, ticks, growthRate, deathRate, cameraLat, cameraLon);
+            if (profiling) drawPhaseBar();
         }
+    ScopedTimer timer(PHASE_PRESENT);
     EndDrawing();
 }
 
 
-void randomizeCells(vector<Cell> &cells) {
-    for (size_t i = 0; i < totalCells; i++) {
-        cells[i].reset();
-    }
-    // Only middle section has a spawn chance
-    for (int x = cellBounds/3.0f; x < cellBounds * 2.0f/3.0f; x++) {
-        for (int y = cellBounds/3.0f; y < cellBounds * 2.0f/3.0f; y++) {
-            for (int z = cellBounds/3.0f; z < cellBounds * 2.0f/3.0f; z++) {
-                cells[threeToOne(x, y, z)].randomizeState();
-            }
-        }
+vector<Simulation> createSimulations(const Options &options) {
+    // Just the rules from the options, or 1 per rule of the wall with 1 thread each (the workers are what run them in parallel)
+    if (options.simulations.empty()) return vector<Simulation>(1, Simulation(options.simulation));
+    vector<Simulation> simulations;
+    for (const string &rule : options.simulations) {
+        SimulationConfig config = options.simulation;
+        config.rules = parseRuleString(rule, options.simulation.rules.boundary, options.neighborhoodMask);
+        config.threads = 1;
+        simulations.push_back(Simulation(config));
     }
-    Cell::clearCellCounts();
+    return simulations;
 }
 
+size_t workerCount(const Options &options, size_t simulationCount) {
+    if (simulationCount == 1) return 1;
+    return std::max<size_t>(1, std::min(options.simulation.threads, simulationCount));
+}
 
-vector<Cell> createCells() {
-    vector<Cell> cells;
-    cells.reserve(totalCells);
-    for (int x = 0; x < cellBounds; x++) {
-        for (int y = 0; y < cellBounds; y++) {
-            for (int z = 0; z < cellBounds; z++) {
-                cells.push_back(Cell({ x, y, z }));
+Generation startGeneration(const Simulation &simulation, DrawMode drawMode) {
+    // What is shown until the first generation from the simulation thread arrives, made here the same way
+    Generation generation;
+    generation.stats = simulation.getStats();
+    generation.ticks = simulation.getTicks();
+    generation.period = 0;
+    generation.cycleStart = 0;
+    generation.replaying = false;
+    buildPyramid(simulation, generation.lod);
+    RenderScratch scratch;
+    buildRenderBuffer(simulation, drawMode, palette, generation.render, scratch);
+    return generation;
+}
+
+vector<int> carryOver(const Simulation &old, int cellBounds, int state) {
+    // The old cells stay centered (cut off when the bounds shrink), with their hp scaled to the new state
+    const int oldBounds = old.getConfig().cellBounds;
+    const int oldState = old.getConfig().rules.state;
+    vector<int> hp((size_t)cellBounds * cellBounds * cellBounds, -1);
+    int start = (cellBounds - oldBounds) / 2;
+    for (int x = 0; x < oldBounds; x++) {
+        for (int y = 0; y < oldBounds; y++) {
+            for (int z = 0; z < oldBounds; z++) {
+                int nx = x + start, ny = y + start, nz = z + start;
+                if (nx < 0 || nx >= cellBounds || ny < 0 || ny >= cellBounds || nz < 0 || nz >= cellBounds) continue;
+                Cell cell = old.getCells()[threeToOne(x, y, z, oldBounds)];
+                cell.jsonStateUpdate(oldState, state);
+                hp[threeToOne(nx, ny, nz, cellBounds)] = cell.getHp();
             }
         }
     }
-    return cells;
+    return hp;
 }
 
+int totalTicks(const vector<Generation *> &shown) {
+    int ticks = 0;
+    for (const Generation *generation : shown) ticks += generation->ticks;
+    return ticks;
+}
+
+
+int main(int argc, char *argv[]) {
 
-int main(void) {
+    traceLane = TRACE_MAIN;
+    CommandLine command;
+    try {
+        command = parseArguments(argc, argv);
+    }
+    catch (std::exception& e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        printUsage(std::cout, "main");
+        exit(EXIT_FAILURE);
+    }
 
-    srand(time(NULL));
+    if (isHeadless(command)) return runHeadless(command);
+
+    std::mt19937 rng(time(NULL));
 
     const int screenWidth = 1200;
     const int screenHeight = 675;
@@ -619,7 +627,8 @@ int main(void) {
     InitWindow(screenWidth, screenHeight, "3D Cellular Automata with Raylib");
     SetWindowState(FLAG_WINDOW_RESIZABLE);
 
-    loadFromJSON();
+    Options options = loadFromJSON(command);
+    int cellBounds = options.simulation.cellBounds;
 
     Camera3D camera = { 0 };
     camera.position = (Vector3){ 10.0f, 10.0f, 10.0f };
@@ -634,17 +643,45 @@ int main(void) {
     const float cameraMoveSpeed = 180.0f/4.0f;
     const float cameraZoomSpeed = cellBounds/10.0f;
 
-    int ticks = 0;
-    int lastAliveCells = Cell::getAliveCells();
+    DrawMode drawMode = DUAL_COLOR;
+
+    // simulations are the rules and the cells the workers start from, the workers tick their own copies (see TickProducer)
+    // There is more than 1 when the simulations option lists rules, they are shown as a wall of thumbnails
+    vector<Simulation> simulations = createSimulations(options);
+    // What is drawn is the newest generation taken from the workers (with its render buffer, so drawing doesn't go
+    // over the cells), it stays put until the next one is taken. Until the first one, it is the one in starts
+    vector<Generation> starts;
+    vector<Generation *> shown;
+    for (Simulation &simulation : simulations) {
+        simulation.randomize(rng);
+        starts.push_back(startGeneration(simulation, drawMode));
+    }
+    for (Generation &start : starts) shown.push_back(&start);
+    size_t workers = workerCount(options, simulations.size());
+    size_t focused = 0;
+    bool showWall = simulations.size() > 1;
+    vector<RenderTexture2D> thumbnails;
+    TickProducer producer;
+    if (options.trace) traceRecorder.start();
+    producer.setPalette(palette);
+    producer.setDrawMode(drawMode);
+    producer.start(simulations, workers);
+
     float growthRate = 1.0f;
-    int lastDeadCells = Cell::getDeadCells();
     float deathRate = 1.0f;
+    // Measured over the last second, since ticks don't line up with frames anymore
+    int ticksPerSecond = 0;
+    int secondStartTicks = 0;
+    int allTicksPerSecond = 0;
+    int secondStartAllTicks = 0;
+    float second = 0;
 
     bool paused = false;
     bool drawBounds = false;
-    bool showHalf = false;
+    ClipView clip = { options.slabs, options.clipPlanes, false, false, options.slicePlane };
+    bool culling = true;
+    bool lod = true;
     bool drawBar = true;
-    DrawMode drawMode = DUAL_COLOR;
     TickMode tickMode = FAST;
 
     ToggleKey mouseTK;
@@ -658,19 +695,23 @@ int main(void) {
     ToggleKey pTK;
     ToggleKey oTK;
     ToggleKey jTK;
+    ToggleKey tTK;
+    ToggleKey lTK;
+    ToggleKey gTK;
+    ToggleKey nTK;
+    ToggleKey kTK;
+    ToggleKey vTK;
+    ToggleKey fTK;
+    ToggleKey leftBracketTK;
+    ToggleKey rightBracketTK;
 
     int updateSpeed = 5;
-    float frame = 0;
-
-    vector<Cell> cells = createCells();
-    randomizeCells(cells);
-    vector<Cell> cells2 = vector<Cell>(cells);
 
     // Main game loop
     while (!WindowShouldClose()) {
 
+        ScopedTimer frameTimer(PHASE_FRAME);
         const float delta = GetFrameTime();
-        frame += delta;
 
         if (IsKeyDown('W') || IsKeyDown(KEY_UP)) cameraLat += cameraMoveSpeed * delta;
         if (IsKeyDown('S') || IsKeyDown(KEY_DOWN)) cameraLat -= cameraMoveSpeed * delta;
@@ -679,40 +720,73 @@ int main(void) {
         if (IsKeyDown('Q') || IsKeyDown(KEY_PAGE_UP)) cameraRadius -= cameraZoomSpeed * delta;
         if (IsKeyDown('E') || IsKeyDown(KEY_PAGE_DOWN)) cameraRadius += cameraZoomSpeed * delta;
         if (IsKeyDown('R')) {
-            randomizeCells(cells);
-            ticks = 0;
+            producer.stop();
+            // Each one gets its own random cells, since they all draw from the same rng
+            for (size_t i = 0; i < simulations.size(); i++) {
+                simulations[i].randomize(rng);
+                starts[i] = startGeneration(simulations[i], drawMode);
+                shown[i] = &starts[i];
+            }
+            secondStartTicks = 0;
+            secondStartAllTicks = 0;
+            producer.start(simulations, workers);
         }
         if (mouseTK.down(IsMouseButtonPressed(MOUSE_LEFT_BUTTON))) paused = !paused;
         if (bTK.down(IsKeyPressed('B'))) drawBounds = !drawBounds;
         if (xTK.down(IsKeyDown('X') && tickMode == MANUAL)) updateSpeed++;
         if (zTK.down(IsKeyDown('Z') && tickMode == MANUAL && updateSpeed > 1)) updateSpeed--;
-        if (cTK.down(IsKeyDown('C'))) showHalf = !showHalf;
-        if (mTK.down(IsKeyDown('M'))) drawMode = (DrawMode)((drawMode + 1) % 5);
+        if (cTK.down(IsKeyDown('C'))) clip.showHalf = !clip.showHalf;
+        if (fTK.down(IsKeyDown('F'))) clip.slicing = !clip.slicing;
+        // The plane's distance is how far the cells are from it, so the slice moves the other way
+        if (leftBracketTK.down(IsKeyDown(KEY_LEFT_BRACKET))) clip.slice.distance += 1;
+        if (rightBracketTK.down(IsKeyDown(KEY_RIGHT_BRACKET))) clip.slice.distance -= 1;
+        if (kTK.down(IsKeyDown('K'))) culling = !culling;
+        if (vTK.down(IsKeyDown('V'))) lod = !lod;
+        if (mTK.down(IsKeyDown('M'))) {
+            // The generations already shown are colored again when they are drawn
+            drawMode = (DrawMode)((drawMode + 1) % 5);
+            producer.setDrawMode(drawMode);
+        }
         if (uTK.down(IsKeyDown('U'))) tickMode = (TickMode)((tickMode + 1) % 3);
         if (pTK.down(IsKeyDown('P'))) drawBar = !drawBar;
+        if (tTK.down(IsKeyDown('T'))) profiling = !profiling;
+        if (lTK.down(IsKeyDown('L'))) {
+            if (tracing) traceRecorder.stop(TRACE_FILE);
+            else traceRecorder.start();
+        }
         if (jTK.down(IsKeyDown('J'))) {
-            int oldBounds = cellBounds;
-            int oldState = STATE;
-            loadFromJSON();
-            cells2 = createCells();
-            int start = (cellBounds - oldBounds) / 2;
-            Vector3Int offset = { start, start, start };
-            for (int x = 0; x < oldBounds; x++) {
-                for (int y = 0; y < oldBounds; y++) {
-                    for (int z = 0; z < oldBounds; z++) {
-                        if (validCellIndex(x, y, z, offset)) {
-                            size_t oldOneIdx = x * oldBounds * oldBounds + y * oldBounds  + z;
-                            cells2[threeToOne(x + offset.x, y + offset.x, z + offset.z)].setHp(cells[oldOneIdx].getHp());
-                        }
-                    }
+            // The workers have copies of the old simulations (with the newest cells), so they are stopped while those are replaced
+            producer.stop();
+            options = loadFromJSON(command);
+            cellBounds = options.simulation.cellBounds;
+            clip = { options.slabs, options.clipPlanes, clip.showHalf, clip.slicing, options.slicePlane };
+            simulations = createSimulations(options);
+            starts.resize(simulations.size());
+            shown.resize(simulations.size());
+            for (size_t i = 0; i < simulations.size(); i++) {
+                // A simulation that didn't exist before starts from random cells
+                if (i >= producer.size()) simulations[i].randomize(rng);
+                else {
+                    int state = simulations[i].getConfig().rules.state;
+                    vector<int> hp = carryOver(producer.simulation(i), cellBounds, state);
+                    simulations[i].setGeneration(hp, countGeneration(hp, state), producer.simulation(i).getTicks());
                 }
+                starts[i] = startGeneration(simulations[i], drawMode);
+                shown[i] = &starts[i];
             }
-            cells = vector<Cell>(cells2);
-            for (size_t i = 0; i < totalCells; i++) {
-                cells[i].jsonStateUpdate(oldState);
-            }
+            workers = workerCount(options, simulations.size());
+            focused = std::min(focused, simulations.size() - 1);
+            showWall = showWall && simulations.size() > 1;
+            secondStartAllTicks = totalTicks(shown);
+            producer.setPalette(palette);
+            producer.start(simulations, workers);
             cameraRadius = 1.75f * cellBounds;
         }
+        if (gTK.down(IsKeyDown('G')) && simulations.size() > 1) showWall = !showWall;
+        if (nTK.down(IsKeyDown('N'))) {
+            focused = (focused + 1) % simulations.size();
+            secondStartTicks = shown[focused]->ticks;
+        }
         if (IsKeyDown(KEY_SPACE)) {
             cameraLat = 20.0f;
             cameraLon = 20.0f;
@@ -745,33 +819,44 @@ int main(void) {
             cameraRadius * sin(degreesToRadians(cameraLat))
         };
 
-        if (!paused && (tickMode == FAST || frame >= 1.0f/updateSpeed)) {
-            if (tickMode == DYNAMIC) {
+        producer.pace(paused, tickMode, updateSpeed);
+        for (size_t i = 0; i < simulations.size(); i++) {
+            // Taking a new one hands the one shown back to the worker, so nothing of it can be read after
+            TickStats before = shown[i]->stats;
+            Generation *newest;
+            {
+                ScopedTimer timer(PHASE_TAKE);
+                newest = producer.takeNewest(i);
+            }
+            if (!newest) continue;
+            shown[i] = newest;
+            if (i == focused) {
+                growthRate = newest->stats.aliveCells / (float)std::max<size_t>(before.aliveCells, 1);
+                deathRate = newest->stats.deadCells / (float)std::max<size_t>(before.deadCells, 1);
+            }
+
+            if (i == focused && tickMode == DYNAMIC) {
                 if (GetFPS() > targetFPS && updateSpeed < GetFPS()) updateSpeed++;
                 else if (GetFPS() < targetFPS && updateSpeed > 1) updateSpeed--;
             }
-            while (tickMode != FAST && frame >= 1.0/updateSpeed) frame -= 1.0/updateSpeed;
-
-            cells2 = vector<Cell>(cells); // create copy to be updated in background
-            thread updateThread(updateCells, std::ref(cells2));
-
-            draw(camera, cells, drawBounds, drawBar, showHalf, paused, drawMode, tickMode, updateSpeed, ticks, growthRate, deathRate, cameraLat, cameraLon);
-
-            updateThread.join();
-            cells = vector<Cell>(cells2); // copy the updated cells to the main cells
-            
-            ticks++;
-            growthRate = Cell::getAliveCells() / (float)lastAliveCells;
-            lastAliveCells = Cell::getAliveCells();
-            deathRate = Cell::getDeadCells() / (float)lastDeadCells;
-            lastDeadCells = Cell::getDeadCells();
         }
-        else {
-            draw(camera, cells, drawBounds, drawBar, showHalf, paused, drawMode, tickMode, updateSpeed, ticks, growthRate, deathRate, cameraLat, cameraLon);
+        second += delta;
+        if (second >= 1.0f) {
+            ticksPerSecond = (shown[focused]->ticks - secondStartTicks) / second;
+            secondStartTicks = shown[focused]->ticks;
+            allTicksPerSecond = (totalTicks(shown) - secondStartAllTicks) / second;
+            secondStartAllTicks = totalTicks(shown);
+            second = 0;
         }
 
+        draw(camera, simulations, thumbnails, showWall, focused, workers, drawBounds, drawBar, clip, culling, lod, paused, drawMode, tickMode,
+            ticksPerSecond, allTicksPerSecond, shown, growthRate, deathRate, cameraLat, cameraLon);
     }
 
+    producer.stop();
+    for (RenderTexture2D &thumbnail : thumbnails) UnloadRenderTexture(thumbnail);
+    if (profiling) printPhaseTimes(std::cout);
+    if (tracing) traceRecorder.stop(TRACE_FILE);
     CloseWindow();        // Close window and OpenGL context
     return 0;
 }
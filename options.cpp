@@ -0,0 +1,211 @@
+#include <math.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "options.h"
+
+
+bool isOptionKey(const string &key) {
+    const string keys[] = {
+        "survival", "spawn", "state", "neighborhood", "neighborhoodMask", "boundary",
+        "dualColorAlive", "dualColorDead", "dualColorDyingAlive", "singleColorAlive", "centerDistMax",
+        "cellBounds", "aliveChanceOnSpawn", "threads", "scheduler", "pinThreads", "firstTouch", "ticksPerBatch", "simulations", "profile", "trace",
+        "slabs", "clipPlanes", "slicePlane", "targetFPS"
+    };
+    for (const string &known : keys) {
+        if (key == known) return true;
+    }
+    return false;
+}
+
+void applySlab(const string &slab, CellBox &box, int cellBounds) {
+    // "<axis>:<from>-<to>" (ex: "x:0-47"), the cells from to to on that axis, both included
+    size_t colon = slab.find(':'), dash = slab.find('-', colon);
+    if (colon != 1 || dash == string::npos || dash == colon + 1 || dash + 1 == slab.size() || string("xyz").find(slab[0]) == string::npos ||
+        slab.find_first_not_of("0123456789-", colon + 1) != string::npos || slab.find('-', dash + 1) != string::npos) {
+        throw std::invalid_argument("slab '" + slab + "' has to be like x:0-47");
+    }
+    int from = std::stoi(slab.substr(colon + 1, dash - colon - 1));
+    int to = std::stoi(slab.substr(dash + 1));
+    if (from < 0 || from > to || to >= cellBounds) throw std::out_of_range("slab '" + slab + "' isn't within cellBounds");
+    int &min = slab[0] == 'x' ? box.min.x : (slab[0] == 'y' ? box.min.y : box.min.z);
+    int &max = slab[0] == 'x' ? box.max.x : (slab[0] == 'y' ? box.max.y : box.max.z);
+    // More than 1 slab on the same axis only leaves where they overlap
+    min = std::max(min, from);
+    max = std::max(min, std::min(max, to + 1));
+}
+
+ClipPlane parsePlane(const json &plane) {
+    // [a, b, c, d] for a * x + b * y + c * z + d >= 0, scaled so (a, b, c) has a length of 1
+    if (!plane.is_array() || plane.size() != 4) throw std::invalid_argument("planes have to be [a, b, c, d], got " + plane.dump());
+    Vector3Float normal = { plane[0].get<float>(), plane[1].get<float>(), plane[2].get<float>() };
+    float length = sqrt(dot(normal, normal));
+    if (length == 0) throw std::invalid_argument("the plane " + plane.dump() + " doesn't face anywhere");
+    return { normal * (1.0f / length), plane[3].get<float>() / length };
+}
+
+CommandLine parseArguments(int argc, char *argv[]) {
+    // --options <file>, --rule <survival/spawn/state/neighborhood>, or --<key> <value> for any options.json key
+    // Values are read as JSON when possible (ex: --survival [2,6,9]) and lists also accept
+    // the rule notation (ex: --survival 2,6,9 or --spawn 4-6)
+    CommandLine command;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0 || i + 1 >= argc) {
+            throw std::invalid_argument("expected '--<key> <value>', got '" + arg + "'");
+        }
+        string key = arg.substr(2);
+        string value = argv[++i];
+
+        if (key == "options") {
+            command.optionsFile = value;
+        }
+        else if (key == "sweep") {
+            // Rules are separated by ';' (ex: --sweep "4/4/5/M;2,6,9/4,6,8-9/{5..10}/M")
+            std::stringstream rules(value);
+            string rule;
+            while (std::getline(rules, rule, ';')) {
+                if (!rule.empty()) command.sweepRules.push_back(rule);
+            }
+        }
+        else if (key == "sweep-file") {
+            std::ifstream reader(value);
+            if (!reader) throw std::invalid_argument("could not open sweep file '" + value + "'");
+            string rule;
+            while (std::getline(reader, rule)) {
+                if (!rule.empty() && rule[0] != '#') command.sweepRules.push_back(rule);
+            }
+        }
+        else if (key == "bench") {
+            if (value != "kernels" && value != "scheduler" && value != "batch" && value != "counters") {
+                throw std::invalid_argument("unknown benchmark '" + value + "' (expected kernels, scheduler, batch or counters)");
+            }
+            command.benchmark = value;
+        }
+        else if (key == "selftest") {
+            if (value != "handoff" && value != "engines" && value != "pool" && value != "culling" && value != "lod" &&
+                value != "render") {
+                throw std::invalid_argument("unknown self test '" + value + "' (expected handoff, engines, pool, culling, lod or render)");
+            }
+            command.selftest = value;
+        }
+        else if (key == "ticks") {
+            command.ticks = std::stoi(value);
+            if (command.ticks < 1) throw std::out_of_range("--ticks has to be at least 1");
+        }
+        else if (key == "seed") {
+            command.seed = std::stoul(value);
+        }
+        else if (key == "report") {
+            command.report = value;
+        }
+        else if (key == "rule") {
+            // Checked once the rest of the options (ex: a custom neighborhoodMask) are loaded
+            vector<string> parts = splitRuleString(value);
+            command.overrides["survival"] = parseNumberList(parts[0]);
+            command.overrides["spawn"] = parseNumberList(parts[1]);
+            command.overrides["state"] = parseState(parts[2]);
+            command.overrides["neighborhood"] = parts[3];
+        }
+        else if ((key == "simulations" || key == "slabs") && value.find('[') == string::npos) {
+            // Same as --sweep: rules (or slabs) separated by ';' (a JSON list works too)
+            std::stringstream rules(value);
+            string rule;
+            command.overrides[key] = json::array();
+            while (std::getline(rules, rule, ';')) {
+                if (!rule.empty()) command.overrides[key].push_back(rule);
+            }
+        }
+        else if (isOptionKey(key)) {
+            json parsed = json::parse(value, nullptr, false);
+            if (parsed.is_discarded()) {
+                if (value.find(',') != string::npos || value.find('-') != string::npos) parsed = parseNumberList(value);
+                else parsed = value;
+            }
+            else if (parsed.is_number() && (key == "survival" || key == "spawn")) {
+                parsed = json::array({ parsed });
+            }
+            command.overrides[key] = parsed;
+        }
+        else {
+            throw std::invalid_argument("unknown option '--" + key + "'");
+        }
+    }
+    return command;
+}
+
+void printUsage(std::ostream &out, const string &program) {
+    string first = "Usage: ";
+    if (program == "main") {
+        out << first << program << " [--options <file>] [--rule <survival/spawn/state/neighborhood>] [--<key> <value>]..." << std::endl;
+        first = "       ";
+    }
+    out << first << program << " --sweep <rule;rule;...> | --sweep-file <file> [--ticks N] [--seed N] [--report <file.csv|file.json>] [--<key> <value>]..." << std::endl;
+    out << "       " << program << " --bench kernels|scheduler|batch|counters [--ticks N] [--seed N] [--<key> <value>]..." << std::endl;
+    out << "       " << program << " --selftest handoff|engines|pool|culling|lod|render" << std::endl;
+}
+
+Options loadOptions(const string &file, const json &overrides) {
+    std::clog << "Loading from JSON..." << std::endl;
+    Options options;
+    json &rules = options.values;
+    std::ifstream reader(file);
+    reader >> rules;
+    reader.close();
+
+    for (json::const_iterator it = overrides.begin(); it != overrides.end(); ++it) {
+        rules[it.key()] = it.value();
+    }
+
+    // Older options files don't have a boundary or neighborhoodMask
+    BoundaryMode boundary = boundaryFromText(rules.value("boundary", "clip"));
+    for (const json &offset : rules.value("neighborhoodMask", json::array())) {
+        options.neighborhoodMask.push_back({ offset.at(0), offset.at(1), offset.at(2) });
+    }
+    SimulationConfig &config = options.simulation;
+    config.rules = makeRuleSet(
+        rules["survival"].get<vector<size_t>>(),
+        rules["spawn"].get<vector<size_t>>(),
+        rules["state"],
+        rules["neighborhood"],
+        boundary,
+        options.neighborhoodMask
+    );
+
+    config.cellBounds = rules["cellBounds"];
+    if (config.cellBounds < 1) throw std::out_of_range("cellBounds has to be at least 1");
+    if (config.rules.radius > config.cellBounds) throw std::out_of_range("the neighborhood reaches further than cellBounds");
+    config.aliveChanceOnSpawn = rules["aliveChanceOnSpawn"];
+    // It is a bernoulli_distribution's chance (see randomizeCells)
+    if (!(config.aliveChanceOnSpawn >= 0 && config.aliveChanceOnSpawn <= 1)) throw std::out_of_range("aliveChanceOnSpawn has to be from 0 to 1");
+    // Read as an int first, a negative number would wrap around to a huge size_t
+    int threads = rules["threads"];
+    if (threads < 1) throw std::out_of_range("threads has to be at least 1");
+    config.threads = threads;
+    config.scheduler = schedulerFromText(rules.value("scheduler", "stealing"));
+    config.pinThreads = rules.value("pinThreads", false);
+    config.firstTouch = rules.value("firstTouch", true);
+    config.ticksPerBatch = rules.value("ticksPerBatch", 1);
+    for (const string &rule : rules.value("simulations", vector<string>())) {
+        // Parsed now so a typo is caught before the window opens (with the same boundary and neighborhoodMask)
+        for (const string &expanded : expandRuleRanges(rule)) {
+            RuleSet parsed = parseRuleString(expanded, boundary, options.neighborhoodMask);
+            if (parsed.radius > config.cellBounds) throw std::out_of_range("the neighborhood of '" + expanded + "' reaches further than cellBounds");
+            options.simulations.push_back(expanded);
+        }
+    }
+    options.slabs = { { 0, 0, 0 }, { config.cellBounds, config.cellBounds, config.cellBounds } };
+    for (const string &slab : rules.value("slabs", vector<string>())) applySlab(slab, options.slabs, config.cellBounds);
+    for (const json &plane : rules.value("clipPlanes", json::array())) options.clipPlanes.push_back(parsePlane(plane));
+    // Through the middle of x when there isn't one
+    options.slicePlane = parsePlane(rules.value("slicePlane", json::array({ 1, 0, 0, -(config.cellBounds / 2) })));
+    options.profile = rules.value("profile", false);
+    options.trace = rules.value("trace", false);
+    if (config.ticksPerBatch < 1) throw std::out_of_range("ticksPerBatch has to be at least 1");
+
+    std::clog << "Finished loading from JSON..." << std::endl;
+    return options;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "culling.h"
+#include "json.hpp"
+#include "simulation.h"
+
+using std::string;
+using std::vector;
+using json = nlohmann::json;
+
+
+#define JSON_FILE "options.json"
+
+
+struct CommandLine {
+    string optionsFile = JSON_FILE;
+    // Keys passed on the command line (ex: --state 6), applied on top of the options file
+    json overrides = json::object();
+
+    // Headless modes: rule sweep (--sweep, see runSweep()), benchmarks (--bench, see runBenchmark())
+    // and self tests (--selftest, see runSelftest())
+    vector<string> sweepRules;
+    string benchmark;
+    string selftest;
+    int ticks = 200;
+    unsigned int seed = 1;
+    string report;
+};
+
+struct Options {
+    SimulationConfig simulation;
+    vector<Vector3Int> neighborhoodMask; // for the rules parsed later on (the sweep)
+    vector<string> simulations; // the rules of the wall of simulations, ranges already expanded (empty for just 1)
+    bool profile;
+    bool trace;
+    // What of the cells the viewer draws: the box the slabs leave (all of them without any) cut by the clip planes,
+    // and where the slice view starts
+    CellBox slabs;
+    vector<ClipPlane> clipPlanes;
+    ClipPlane slicePlane;
+    // Everything that was loaded, for the keys only the viewer uses (colors, targetFPS)
+    json values;
+};
+
+
+// Both throw std::exception when something is missing or doesn't make sense
+CommandLine parseArguments(int argc, char *argv[]);
+// program is main for the viewer or headless for the runner without it (which has no viewer line)
+void printUsage(std::ostream &out, const string &program);
+Options loadOptions(const string &file, const json &overrides);
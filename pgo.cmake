@@ -0,0 +1,122 @@
+# Profile guided optimization, run from the repo with: cmake -P pgo.cmake
+#   1. Builds with PGOGenerate (see CMakeLists.txt) and runs the benchmarks on the training cases below
+#   2. Builds again with PGOUse from those profiles: the optimized viewer (when Raylib is found) and headless
+#   3. Builds headless with just -O2 (like the compile line in the README) and times both on the same cases
+# The report (ticks/sec of both builds) is printed and written to <PGO_BUILD_DIR>/pgo-report.md
+# -D options (before -P): PGO_BUILD_DIR (default build-pgo), PGO_TRAIN_TICKS (default 60), PGO_REPORT_TICKS (default 100)
+
+cmake_minimum_required(VERSION 3.13)
+
+set(SOURCE_DIR ${CMAKE_CURRENT_LIST_DIR})
+if(NOT PGO_BUILD_DIR)
+    set(PGO_BUILD_DIR ${SOURCE_DIR}/build-pgo)
+endif()
+get_filename_component(PGO_BUILD_DIR ${PGO_BUILD_DIR} ABSOLUTE)
+if(NOT PGO_TRAIN_TICKS)
+    set(PGO_TRAIN_TICKS 60)
+endif()
+if(NOT PGO_REPORT_TICKS)
+    set(PGO_REPORT_TICKS 100)
+endif()
+
+# rule|boundary|cellBounds: the README examples at a small and a big size, wrapped edges, a radius 1 von Neumann
+# neighborhood for its specialized kernel, and a radius 2 von Neumann and a big Moore one that only have the generic
+# kernels (the specialized ones are radius 1 only, so both of their rows in the report are the generic kernel)
+set(CASES
+    "9-18/5-7,12-13,15/6/M|clip|64"
+    "2,6,9/4,6,8-9/10/M|clip|96"
+    "2,6,9/4,6,8-9/10/M|wrap|48"
+    "0-6/1-3/2/VN|clip|64"
+    "3-9/4-6/4/VN2|clip|64"
+    "40-70/30-50/5/M2|clip|48"
+)
+set(OPTIONS_FILE ${SOURCE_DIR}/options.json)
+
+function(run)
+    execute_process(COMMAND ${ARGN} RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_VARIABLE output)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${ARGN} failed:\n${output}")
+    endif()
+    set(output "${output}" PARENT_SCOPE)
+endfunction()
+
+function(case_arguments case out)
+    string(REPLACE "|" ";" parts "${case}")
+    list(GET parts 0 rule)
+    list(GET parts 1 boundary)
+    list(GET parts 2 bounds)
+    set(${out} --options ${OPTIONS_FILE} --rule ${rule} --boundary ${boundary} --cellBounds ${bounds} PARENT_SCOPE)
+endfunction()
+
+function(hundredths value out)
+    # CMake only does integer math, so the benchmark's ticks/sec (ex: 43.7798) are compared in hundredths
+    if(NOT value MATCHES "^([0-9]+)(\\.([0-9]*))?$")
+        message(FATAL_ERROR "could not read '${value}' from the benchmark")
+    endif()
+    string(SUBSTRING "${CMAKE_MATCH_3}00" 0 2 fraction)
+    math(EXPR result "${CMAKE_MATCH_1} * 100 + ${fraction}")
+    set(${out} ${result} PARENT_SCOPE)
+endfunction()
+
+# 1. Instrumented build and training (the old profiles are removed so they don't add up over runs)
+set(PGO_DIR ${PGO_BUILD_DIR}/pgo/profiles)
+file(REMOVE_RECURSE ${PGO_DIR})
+message(STATUS "PGO: instrumented build")
+run(${CMAKE_COMMAND} -S ${SOURCE_DIR} -B ${PGO_BUILD_DIR}/pgo -DCMAKE_BUILD_TYPE=PGOGenerate -DCA_PGO_DIR=${PGO_DIR})
+run(${CMAKE_COMMAND} --build ${PGO_BUILD_DIR}/pgo --target headless)
+foreach(case ${CASES})
+    message(STATUS "PGO: training on ${case}")
+    case_arguments("${case}" arguments)
+    foreach(bench kernels scheduler batch)
+        run(${PGO_BUILD_DIR}/pgo/headless ${arguments} --bench ${bench} --ticks ${PGO_TRAIN_TICKS})
+    endforeach()
+endforeach()
+# The pool of workers of the wall of simulations
+run(${PGO_BUILD_DIR}/pgo/headless --selftest pool)
+
+# 2. Optimized build from the profiles, in the same directory since the profiles are named after its object files
+message(STATUS "PGO: optimized build")
+run(${CMAKE_COMMAND} -S ${SOURCE_DIR} -B ${PGO_BUILD_DIR}/pgo -DCMAKE_BUILD_TYPE=PGOUse -DCA_PGO_DIR=${PGO_DIR})
+run(${CMAKE_COMMAND} --build ${PGO_BUILD_DIR}/pgo)
+
+# 3. The plain -O2 build to compare against
+message(STATUS "PGO: -O2 build")
+run(${CMAKE_COMMAND} -S ${SOURCE_DIR} -B ${PGO_BUILD_DIR}/o2 -DCMAKE_BUILD_TYPE=None -DCMAKE_CXX_FLAGS=-O2)
+run(${CMAKE_COMMAND} --build ${PGO_BUILD_DIR}/o2 --target headless)
+
+# The kernels benchmark of both on every case, ticks/sec of the generic and the specialized kernels
+set(report "# PGO report\n\n")
+string(APPEND report "Kernels benchmark, ${PGO_REPORT_TICKS} ticks, best of the benchmark's repeats, threads from options.json.\n")
+string(APPEND report "-O2 is the plain build, PGO is the PGOUse build (-O3, -march=native and LTO unless they were turned off).\n\n")
+string(APPEND report "| case | kernel | -O2 ticks/sec | PGO ticks/sec | speedup |\n|:-|:-|-:|-:|-:|\n")
+foreach(case ${CASES})
+    message(STATUS "PGO: timing ${case}")
+    case_arguments("${case}" arguments)
+    foreach(build o2 pgo)
+        run(${PGO_BUILD_DIR}/${build}/headless ${arguments} --bench kernels --ticks ${PGO_REPORT_TICKS})
+        foreach(kernel generic specialized)
+            string(REGEX MATCH "\n${kernel} +[^ ]+ +([^ ]+)" line "\n${output}")
+            set(${build}_${kernel} ${CMAKE_MATCH_1})
+        endforeach()
+    endforeach()
+    foreach(kernel generic specialized)
+        hundredths("${o2_${kernel}}" before)
+        hundredths("${pgo_${kernel}}" after)
+        set(speedup "?")
+        if(before GREATER 0)
+            math(EXPR ratio "${after} * 100 / ${before}")
+            math(EXPR whole "${ratio} / 100")
+            math(EXPR fraction "${ratio} % 100")
+            if(fraction LESS 10)
+                set(fraction "0${fraction}")
+            endif()
+            set(speedup "${whole}.${fraction}")
+        endif()
+        string(REPLACE "|" " " name "${case}")
+        string(APPEND report "| ${name} | ${kernel} | ${o2_${kernel}} | ${pgo_${kernel}} | x${speedup} |\n")
+    endforeach()
+endforeach()
+
+file(WRITE ${PGO_BUILD_DIR}/pgo-report.md "${report}")
+message("${report}")
+message(STATUS "PGO: optimized programs in ${PGO_BUILD_DIR}/pgo, report in ${PGO_BUILD_DIR}/pgo-report.md")
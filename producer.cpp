@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "instrumentation.h"
+#include "producer.h"
+
+
+string textFromEnum(TickMode tm) {
+    switch (tm) {
+        case MANUAL: return "Manual";
+        case FAST: return "Fastest";
+        case DYNAMIC: return "Dynamic";
+    }
+    return "";
+}
+
+
+TickProducer::Slot *TickProducer::nextSlot(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point &wake) {
+    // Called with lock held. The free slot with the fewest ticks that is due, or nullptr and when to look again
+    Slot *next = nullptr;
+    wake = now + std::chrono::milliseconds(10); // to notice stop() and pause
+    for (std::unique_ptr<Slot> &slot : slots) {
+        if (slot->ticking) continue;
+        if (slot->simulation.isReplaying() && !slot->generations.taken()) {
+            // Replaying is so cheap it would spin as fast as it can, so it waits for the renderer to take every generation
+            wake = std::min(wake, now + std::chrono::milliseconds(1));
+            continue;
+        }
+        if (mode != FAST && slot->nextTick > now) {
+            wake = std::min(wake, slot->nextTick);
+            continue;
+        }
+        if (!next || slot->simulation.getTicks() < next->simulation.getTicks()) next = slot.get();
+    }
+    return next;
+}
+
+void TickProducer::publish(Slot &slot) {
+    ScopedTimer timer(PHASE_PUBLISH);
+    const Simulation &simulation = slot.simulation;
+    Generation &generation = slot.generations.writing();
+    {
+        ScopedTimer renderTimer(PHASE_RENDER);
+        buildPyramid(simulation, generation.lod);
+        buildRenderBuffer(simulation, (DrawMode)drawMode.load(), palette, generation.render, slot.scratch);
+    }
+    generation.stats = simulation.getStats();
+    generation.ticks = simulation.getTicks();
+    generation.period = simulation.getPeriod();
+    generation.cycleStart = simulation.getCycleStart();
+    generation.replaying = simulation.isReplaying();
+    slot.generations.publish();
+}
+
+void TickProducer::run(int lane) {
+    traceLane = lane;
+    while (running) {
+        if (paused) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        Slot *slot;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now(), wake;
+            slot = nextSlot(now, wake);
+            if (!slot) {
+                changed.wait_until(guard, wake);
+                continue;
+            }
+            slot->ticking = true;
+            if (mode != FAST) {
+                // DYNAMIC and MANUAL tick at ticksPerSecond (if a tick ran long, the next one doesn't try to catch up)
+                slot->nextTick = std::max(slot->nextTick + std::chrono::microseconds(1000000 / ticksPerSecond), now);
+            }
+        }
+        {
+            ScopedTimer timer(PHASE_TICK);
+            // In FAST mode, ticksPerBatch ticks are done at a time
+            slot->simulation.tick(mode == FAST ? slot->simulation.getConfig().ticksPerBatch : 1);
+            publish(*slot);
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            slot->ticking = false;
+        }
+        changed.notify_one();
+    }
+}
+
+void TickProducer::start(const vector<Simulation> &from, size_t workerCount) {
+    stop();
+    workerCount = std::max<size_t>(1, std::min(workerCount, from.size()));
+    if (workerCount > 1) {
+        for (const Simulation &simulation : from) {
+            if (simulation.getConfig().threads != 1) throw std::invalid_argument("simulations that share workers have to have 1 thread each");
+        }
+    }
+    if (slots.size() != from.size()) {
+        slots.clear();
+        for (size_t i = 0; i < from.size(); i++) slots.push_back(std::unique_ptr<Slot>(new Slot()));
+    }
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < from.size(); i++) {
+        slots[i]->simulation = from[i]; // into the same memory when the size didn't change (see Simulation)
+        slots[i]->generations.discard(); // from before the restart
+        slots[i]->ticking = false;
+        slots[i]->nextTick = now;
+    }
+    running = true;
+    workers.resize(workerCount);
+    for (size_t i = 0; i < workerCount; i++) {
+        // A single worker is the simulation lane of the trace (its update threads have their own), otherwise
+        // the simulations have no update threads and the workers take those lanes
+        int lane = workerCount == 1 ? (int)TRACE_SIMULATION : (int)(TRACE_WORKERS + i);
+        workers[i] = std::thread(&TickProducer::run, this, lane);
+    }
+}
+
+void TickProducer::stop() {
+    if (!running) return;
+    running = false;
+    changed.notify_all();
+    for (std::thread &worker : workers) worker.join();
+    workers.clear();
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lod.h"
+#include "render.h"
+#include "simulation.h"
+
+using std::string;
+using std::vector;
+
+
+enum TickMode {
+    FAST = 0,
+    DYNAMIC = 1,
+    MANUAL = 2
+};
+
+
+struct Generation {
+    // A finished generation, as the simulation thread hands it to the renderer (see TickProducer)
+    TickStats stats;
+    int ticks;
+    int period;
+    int cycleStart;
+    bool replaying;
+    // Made on the simulation thread too, so the renderer doesn't have to
+    LodPyramid lod;
+    RenderBuffer render;
+};
+
+
+string textFromEnum(TickMode tm);
+
+
+template <typename T>
+class TripleBuffer {
+    // Hands the newest value from 1 writer thread to 1 reader thread without either of them ever waiting:
+    // the writer fills its back slot and swaps it with the middle one, and the reader swaps its front slot
+    // with the middle one when there is something new in it. The slots are only ever swapped (an atomic exchange
+    // of the index), so each one belongs to the writer, the reader or the middle, and is never written while it is read
+private:
+    static const int FRESH = 4; // in middle when it holds a value the reader hasn't taken
+    T slots[3];
+    std::atomic<int> middle{ 1 };
+    int back = 0;
+    int front = 2;
+public:
+    // Writer side: fill writing(), then publish() it
+    T &writing() { return slots[back]; }
+    void publish() { back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH; }
+    bool taken() const { return !(middle.load(std::memory_order_acquire) & FRESH); }
+
+    // Reader side: the newest value if there is one it hasn't taken yet, otherwise nullptr
+    // It stays valid (and only the reader can change it) until the next call that doesn't return nullptr
+    T *takeNewest() {
+        if (taken()) return nullptr;
+        front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+        return &slots[front];
+    }
+
+    // Only when neither side is using it: forgets a value that hasn't been taken
+    void discard() { middle = middle & ~FRESH; }
+};
+
+
+class TickProducer {
+    // Runs Simulations on their own threads, so a slow tick doesn't hold up a frame and FAST mode isn't
+    // limited to 1 tick per frame. Every finished generation is published to the simulation's triple buffer,
+    // and the renderer takes whichever one is the newest (older ones it never got to are just overwritten)
+    // Any number of simulations share 1 pool of workers: a free worker always takes the simulation that is
+    // the furthest behind (the fewest ticks) out of the ones that are due, so a slow rule doesn't starve the others
+private:
+    struct Slot {
+        Simulation simulation;
+        TripleBuffer<Generation> generations;
+        // The rest is guarded by lock
+        bool ticking = false; // a worker has it
+        std::chrono::steady_clock::time_point nextTick;
+        RenderScratch scratch; // only used by whichever worker has it
+    };
+
+    vector<std::thread> workers;
+    std::atomic<bool> running{ false };
+    std::atomic<bool> paused{ false };
+    std::atomic<int> mode{ FAST };
+    std::atomic<int> ticksPerSecond{ 1 };
+    std::atomic<int> drawMode{ DUAL_COLOR };
+    Palette palette = {}; // only changed while no workers are running
+
+    // Only changed while no workers are running
+    vector<std::unique_ptr<Slot>> slots;
+    std::mutex lock;
+    std::condition_variable changed;
+
+    Slot *nextSlot(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point &wake);
+    void publish(Slot &slot);
+    void run(int lane);
+
+public:
+    ~TickProducer() { stop(); }
+
+    // Takes a copy of the simulations and starts ticking them on workerCount threads
+    // (their rules and settings can't change while it is running, so stop it before reloading)
+    // With more than 1 worker the simulations have to have 1 thread each: the pool is what runs them in parallel
+    void start(const vector<Simulation> &from, size_t workerCount);
+    void start(const Simulation &from) { start(vector<Simulation>(1, from), 1); }
+    void stop();
+
+    void pace(bool isPaused, TickMode tickMode, int speed) {
+        // Called every frame, the workers are only woken up for a change
+        bool different = paused.exchange(isPaused) != isPaused;
+        different = mode.exchange(tickMode) != tickMode || different;
+        different = ticksPerSecond.exchange(std::max(speed, 1)) != std::max(speed, 1) || different;
+        if (different) changed.notify_all();
+    }
+
+    // How the render buffers are colored: the palette can only change while it is stopped, the draw mode any time
+    // (the generations already made keep the old one)
+    void setPalette(const Palette &colors) { palette = colors; }
+    void setDrawMode(DrawMode mode) { drawMode = mode; }
+
+    size_t size() const { return slots.size(); }
+    // The newest generation of simulation i if there is one the renderer hasn't taken yet (see TripleBuffer)
+    Generation *takeNewest(size_t i) { return slots[i]->generations.takeNewest(); }
+    // The workers' copy of simulation i, which is ahead of the generations taken (only while it is stopped)
+    const Simulation &simulation(size_t i) const { return slots[i]->simulation; }
+};
@@ -0,0 +1,206 @@
+#include <math.h>
+#include <algorithm>
+
+#include "instrumentation.h"
+#include "render.h"
+
+
+InstanceColor dualColor(const Palette &palette, int hp, int state) {
+    const InstanceColor &alive = palette.dualColorAlive, &dead = palette.dualColorDead;
+    return {
+        (unsigned char)(dead.r + (float)(alive.r - dead.r)/(state + 1) * (hp + 1)),
+        (unsigned char)(dead.g + (float)(alive.g - dead.g)/(state + 1) * (hp + 1)),
+        (unsigned char)(dead.b + (float)(alive.b - dead.b)/(state + 1) * (hp + 1)),
+        255
+    };
+}
+InstanceColor rgbColor(Vector3Float index, int bounds) {
+    return {
+        (unsigned char)(index.x/bounds * 255),
+        (unsigned char)(index.y/bounds * 255),
+        (unsigned char)(index.z/bounds * 255),
+        255
+    };
+}
+InstanceColor dualColorDying(const Palette &palette, int hp, int state) {
+    if (hp >= state) return palette.dualColorDyingAlive;
+    float intensity = (1.0f + hp)/(state + 2.0f);
+    unsigned char brightness = (int)(intensity * 255);
+    return { brightness, brightness, brightness, 255 };
+}
+InstanceColor singleColor(const Palette &palette, int hp, int state) {
+    float intensity = 3.0f/(state + 3.0f) + hp/(state + 3.0f);
+    return {
+        (unsigned char)(intensity * palette.singleColorAlive.r),
+        (unsigned char)(intensity * palette.singleColorAlive.g),
+        (unsigned char)(intensity * palette.singleColorAlive.b),
+        255
+    };
+}
+InstanceColor distColor(const Palette &palette, Vector3Float index, int bounds) {
+    int cap = bounds/2;
+    Vector3Float fromCenter = index - Vector3Float{ (float)cap, (float)cap, (float)cap };
+    float dist = sqrt(dot(fromCenter, fromCenter));
+    float intensity = 2.0f/(cap * sqrt(3.0f) + 2.0f) + dist/(cap * sqrt(3.0f) + 2.0f);
+    return {
+        (unsigned char)(intensity * palette.centerDistMax.r),
+        (unsigned char)(intensity * palette.centerDistMax.g),
+        (unsigned char)(intensity * palette.centerDistMax.b),
+        255
+    };
+}
+
+template <typename Apply>
+void withColorFunction(const Palette &palette, DrawMode drawMode, int bounds, int state, Apply apply) {
+    // A bit exessive to put this on the outside, but is saves doing a check per cell
+    // at the cost of extra code (apply gets a color(hp, index) for the draw mode)
+    switch (drawMode) {
+        case DUAL_COLOR:
+            apply([&](int hp, Vector3Float) { return dualColor(palette, hp, state); });
+            break;
+        case RGB_CUBE:
+            apply([&](int, Vector3Float index) { return rgbColor(index, bounds); });
+            break;
+        case DUAL_COLOR_DYING:
+            apply([&](int hp, Vector3Float) { return dualColorDying(palette, hp, state); });
+            break;
+        case SINGLE_COLOR:
+            apply([&](int hp, Vector3Float) { return singleColor(palette, hp, state); });
+            break;
+        case CENTER_DIST:
+            apply([&](int, Vector3Float index) { return distColor(palette, index, bounds); });
+            break;
+    }
+}
+
+InstanceColor cellColor(const Palette &palette, DrawMode drawMode, int hp, Vector3Float index, int bounds, int state) {
+    InstanceColor color = { 0, 0, 0, 255 };
+    withColorFunction(palette, drawMode, bounds, state, [&](auto colorOf) { color = colorOf(hp, index); });
+    return color;
+}
+
+
+Vector3Float cellPosition(Vector3Int index, int bounds) {
+    // The center of the cell's cube, the grid is centered on 0 (see cellCorner())
+    return { index.x - (bounds - 1.0f) / 2, index.y - (bounds - 1.0f) / 2, index.z - (bounds - 1.0f) / 2 };
+}
+
+Vector3Int instanceIndex(const RenderBuffer &buffer, size_t i) {
+    const Vector3Float &position = buffer.positions[i];
+    const float center = (buffer.cellBounds - 1.0f) / 2;
+    return { (int)lround(position.x + center), (int)lround(position.y + center), (int)lround(position.z + center) };
+}
+
+size_t chunkOf(Vector3Int index, int chunks) {
+    return threeToOne(index.x / CHUNK_SIZE, index.y / CHUNK_SIZE, index.z / CHUNK_SIZE, chunks);
+}
+
+void buildRenderBuffer(const Simulation &simulation, DrawMode drawMode, const Palette &palette, RenderBuffer &buffer, RenderScratch &scratch) {
+    const SimulationConfig &config = simulation.getConfig();
+    const CellVector &cells = simulation.getCells();
+    const int bounds = config.cellBounds;
+    const int chunks = (bounds + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    const size_t chunkCount = (size_t)chunks * chunks * chunks;
+    buffer.cellBounds = bounds;
+    buffer.state = config.rules.state;
+    buffer.drawMode = drawMode;
+    scratch.parts.resize(std::max<size_t>(config.threads, 1));
+
+    // 1. Each thread compacts the drawn cells of its slab (in x, y, z order) and counts how many are in each chunk
+    forEachUpdateThread(config, [&](size_t thread, int start, int end) {
+        TraceSpan span(PHASE_RENDER);
+        RenderScratch::Part &part = scratch.parts[thread];
+        part.cells.clear();
+        part.chunkCounts.assign(chunkCount, 0);
+        for (int x = start; x < end; x++) {
+            for (int y = 0; y < bounds; y++) {
+                for (int z = 0; z < bounds; z++) {
+                    int hp = cells[threeToOne(x, y, z, bounds)].getHp();
+                    if (hp < 0) continue;
+                    part.cells.push_back({ { x, y, z }, hp });
+                    part.chunkCounts[chunkOf({ x, y, z }, chunks)]++;
+                }
+            }
+        }
+    });
+
+    // 2. The prefix sums: a chunk starts after every chunk before it, and a thread's part of it after the threads before it
+    // (the slabs are in order of x, so every chunk's cells stay in x, y, z order)
+    size_t total = 0;
+    buffer.chunkStart.resize(chunkCount + 1);
+    for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+        buffer.chunkStart[chunk] = total;
+        for (RenderScratch::Part &part : scratch.parts) {
+            size_t count = part.chunkCounts[chunk];
+            part.chunkCounts[chunk] = total;
+            total += count;
+        }
+    }
+    buffer.chunkStart[chunkCount] = total;
+    buffer.positions.resize(total);
+    buffer.colors.resize(total);
+    buffer.hp.resize(total);
+
+    // 3. Each thread copies its cells to where they go, with their color
+    forEachUpdateThread(config, [&](size_t thread, int, int) {
+        TraceSpan span(PHASE_RENDER);
+        RenderScratch::Part &part = scratch.parts[thread];
+        withColorFunction(palette, drawMode, bounds, buffer.state, [&](auto colorOf) {
+            for (const RenderScratch::Compacted &cell : part.cells) {
+                size_t i = part.chunkCounts[chunkOf(cell.index, chunks)]++;
+                buffer.positions[i] = cellPosition(cell.index, bounds);
+                buffer.colors[i] = colorOf(cell.hp, Vector3Float{ (float)cell.index.x, (float)cell.index.y, (float)cell.index.z });
+                buffer.hp[i] = cell.hp;
+            }
+        });
+    });
+}
+
+void recolorRenderBuffer(RenderBuffer &buffer, DrawMode drawMode, const Palette &palette) {
+    buffer.drawMode = drawMode;
+    withColorFunction(palette, drawMode, buffer.cellBounds, buffer.state, [&](auto colorOf) {
+        for (size_t i = 0; i < buffer.hp.size(); i++) {
+            Vector3Int index = instanceIndex(buffer, i);
+            buffer.colors[i] = colorOf(buffer.hp[i], Vector3Float{ (float)index.x, (float)index.y, (float)index.z });
+        }
+    });
+}
+
+ChunkGrid countChunks(const RenderBuffer &buffer, const CellBox &box, const vector<ClipPlane> &planes) {
+    ChunkGrid grid = makeChunkGrid(buffer.cellBounds, box, planes);
+    for (size_t chunk = 0; chunk < grid.drawn.size(); chunk++) {
+        size_t start = buffer.chunkStart[chunk], end = buffer.chunkStart[chunk + 1];
+        if (start == end || grid.clip[chunk] == CHUNK_OUTSIDE) continue;
+        if (grid.clip[chunk] == CHUNK_WHOLE) {
+            grid.drawn[chunk] = (int)(end - start);
+            continue;
+        }
+        for (size_t i = start; i < end; i++) grid.drawn[chunk] += cellInside(grid, instanceIndex(buffer, i));
+    }
+    findSolidChunks(grid);
+    return grid;
+}
+
+vector<size_t> sliceInstances(const RenderBuffer &buffer, const ChunkGrid &grid, const ClipPlane &plane, CullStats &stats) {
+    vector<size_t> slice;
+    for (size_t chunk = 0; chunk < grid.clip.size(); chunk++) {
+        size_t start = buffer.chunkStart[chunk], end = buffer.chunkStart[chunk + 1];
+        if (start == end) continue;
+        stats.chunks++;
+        if (grid.clip[chunk] == CHUNK_OUTSIDE) continue;
+        // The plane's cells are the ones less than half a cell away, so most chunks are too far from it to have any
+        float low, high;
+        planeRange(plane, chunkCells(grid, (int)chunk), low, high);
+        if (high < -0.5f || low >= 0.5f) continue;
+        stats.sliceChunks++;
+        bool whole = grid.clip[chunk] == CHUNK_WHOLE;
+        for (size_t i = start; i < end; i++) {
+            Vector3Int index = instanceIndex(buffer, i);
+            float distance = planeDistance(plane, index);
+            if (distance < -0.5f || distance >= 0.5f || !(whole || cellInside(grid, index))) continue;
+            slice.push_back(i);
+        }
+    }
+    stats.drawnCells += slice.size();
+    return slice;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+
+#include "culling.h"
+#include "simulation.h"
+
+using std::vector;
+
+
+enum DrawMode {
+    DUAL_COLOR = 0,
+    RGB_CUBE = 1,
+    DUAL_COLOR_DYING = 2,
+    SINGLE_COLOR = 3,
+    CENTER_DIST = 4
+};
+
+
+struct InstanceColor {
+    // The same layout as Raylib's Color (this has no Raylib, so it can be built on the simulation thread)
+    unsigned char r, g, b, a;
+};
+
+struct Palette {
+    // The draw modes' colors from options.json (see loadFromJSON() in main.cpp)
+    InstanceColor dualColorAlive;
+    InstanceColor dualColorDead;
+    InstanceColor dualColorDyingAlive;
+    InstanceColor singleColorAlive;
+    InstanceColor centerDistMax;
+};
+
+struct RenderBuffer {
+    // Every drawn cell (hp >= 0) of a generation as 1 cube, ready to be drawn as is: where its center is and its color
+    // They are in order of chunk (see ChunkGrid), the ones of chunk c are [chunkStart[c], chunkStart[c + 1]),
+    // and in x, y, z order within a chunk
+    int cellBounds = 0;
+    int state = 0;
+    DrawMode drawMode = DUAL_COLOR;
+    vector<Vector3Float> positions;
+    vector<InstanceColor> colors;
+    vector<int> hp; // so they can be colored again when the draw mode changes
+    vector<size_t> chunkStart;
+};
+
+struct RenderScratch {
+    // What each update thread compacts its slab into while a RenderBuffer is built, kept between builds to reuse the memory
+    struct Compacted {
+        Vector3Int index;
+        int hp;
+    };
+    struct Part {
+        vector<Compacted> cells;
+        vector<size_t> chunkCounts; // then where the thread's cells of each chunk go (the prefix sums)
+    };
+    vector<Part> parts;
+};
+
+
+// The color of a cell with the draw mode, by its hp and index (or the center of a block of cells, see lod.h)
+InstanceColor cellColor(const Palette &palette, DrawMode drawMode, int hp, Vector3Float index, int bounds, int state);
+
+// On the simulation's update threads: each one compacts the drawn cells of its x slab and counts them per chunk, the counts
+// are prefix summed (by chunk, then thread) into where every thread's part of each chunk goes, and then each copies its part there
+void buildRenderBuffer(const Simulation &simulation, DrawMode drawMode, const Palette &palette, RenderBuffer &buffer, RenderScratch &scratch);
+void recolorRenderBuffer(RenderBuffer &buffer, DrawMode drawMode, const Palette &palette);
+
+// The cell instance i is
+Vector3Int instanceIndex(const RenderBuffer &buffer, size_t i);
+// The same as countChunks() from the cells, but only the chunks the box or planes cut into are counted 1 instance at a time
+ChunkGrid countChunks(const RenderBuffer &buffer, const CellBox &box, const vector<ClipPlane> &planes = {});
+// The instances within half a cell of the plane (-0.5 <= planeDistance() < 0.5) that are inside the grid's box and planes,
+// only the chunks the plane goes through are looked at (the grid only needs its clip, see makeChunkGrid())
+vector<size_t> sliceInstances(const RenderBuffer &buffer, const ChunkGrid &grid, const ClipPlane &plane, CullStats &stats);
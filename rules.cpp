@@ -0,0 +1,271 @@
+#include <ctype.h>
+#include <math.h>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "rules.h"
+
+
+string textFromEnum(NeighborType nt) {
+    switch (nt) {
+        case MOORE: return "Moore";
+        case VON_NEUMANN: return "von Neumann";
+        case CUSTOM: return "Custom";
+    }
+    return "";
+}
+string textFromEnum(BoundaryMode bm) {
+    switch (bm) {
+        case CLIP: return "Clip";
+        case WRAP: return "Wrap";
+        case MIRROR: return "Mirror";
+    }
+    return "";
+}
+
+vector<size_t> parseNumberList(const string &text, size_t maxValue) {
+    // "5-7,12-13,15" -> [5, 6, 7, 12, 13, 15]
+    vector<size_t> values;
+    std::stringstream stream(text);
+    string part;
+    while (std::getline(stream, part, ',')) {
+        if (part.empty()) continue;
+        size_t dash = part.find('-');
+        // Every character has to be used (so "4x" and "5-7-9" aren't just cut short), and stoul would take
+        // a sign and wrap a negative number around
+        auto number = [&](const string &digits) {
+            if (digits.empty() || !isdigit((unsigned char)digits[0])) throw std::invalid_argument("");
+            size_t used;
+            size_t value = std::stoul(digits, &used);
+            if (used != digits.size()) throw std::invalid_argument("");
+            return value;
+        };
+        size_t low, high;
+        try {
+            low = number(part.substr(0, dash));
+            high = dash == string::npos ? low : number(part.substr(dash + 1));
+            if (low > high) throw std::invalid_argument("");
+        }
+        catch (std::logic_error&) {
+            throw std::invalid_argument("invalid number or range '" + part + "'");
+        }
+        if (high > maxValue) {
+            throw std::out_of_range("neighbor count " + std::to_string(high) + " is above " + std::to_string(maxValue));
+        }
+        for (size_t i = low; i <= high; i++) values.push_back(i);
+    }
+    return values;
+}
+
+string numberListToString(const vector<uint8_t> &counts) {
+    // Inverse of parseNumberList, collapses runs into ranges
+    string text;
+    for (size_t i = 0; i < counts.size(); i++) {
+        if (!counts[i]) continue;
+        size_t end = i;
+        while (end + 1 < counts.size() && counts[end + 1]) end++;
+        if (!text.empty()) text += ",";
+        text += std::to_string(i);
+        if (end > i) text += "-" + std::to_string(end);
+        i = end;
+    }
+    return text;
+}
+
+void setCounts(vector<uint8_t> &counts, const vector<size_t> &values, size_t maxNeighbors) {
+    // Indexed by neighbor count, so it has to fit every count the neighborhood can have
+    counts.assign(maxNeighbors + 1, false);
+    for (size_t value : values) {
+        if (value > maxNeighbors) {
+            throw std::out_of_range("neighbor count " + std::to_string(value) + " is above " + std::to_string(maxNeighbors));
+        }
+        counts[value] = true;
+    }
+}
+
+void neighborhoodFromText(const string &text, NeighborType &type, int &radius) {
+    // "M", "VN", "custom", with an optional radius for M and VN (ex: "M2", "VN3")
+    size_t digits = text.find_first_of("0123456789");
+    string name = text.substr(0, digits);
+    radius = 1;
+    if (digits != string::npos) {
+        try {
+            size_t used;
+            radius = std::stoi(text.substr(digits), &used);
+            if (digits + used != text.size() || radius < 1 || radius > MAX_RADIUS) throw std::invalid_argument("");
+        }
+        catch (std::logic_error&) {
+            throw std::invalid_argument("invalid neighborhood radius in '" + text + "' (expected 1 to " + std::to_string(MAX_RADIUS) + ")");
+        }
+    }
+    if (name == "M") type = MOORE;
+    else if (name == "VN") type = VON_NEUMANN;
+    else if (name == "custom" && digits == string::npos) type = CUSTOM;
+    else throw std::invalid_argument("unknown neighborhood '" + text + "' (expected M, VN, M<radius>, VN<radius> or custom)");
+}
+
+string neighborhoodToText(NeighborType type, int radius) {
+    if (type == CUSTOM) return "custom";
+    return (type == MOORE ? "M" : "VN") + (radius > 1 ? std::to_string(radius) : "");
+}
+
+vector<Vector3Int> neighborhoodOffsets(NeighborType type, int radius, const vector<Vector3Int> &customOffsets) {
+    vector<Vector3Int> offsets;
+    if (type == CUSTOM) return customOffsets;
+    for (int x = -radius; x <= radius; x++) {
+        for (int y = -radius; y <= radius; y++) {
+            for (int z = -radius; z <= radius; z++) {
+                if (x == 0 && y == 0 && z == 0) continue;
+                if (type == VON_NEUMANN && abs(x) + abs(y) + abs(z) > radius) continue;
+                offsets.push_back({ x, y, z });
+            }
+        }
+    }
+    return offsets;
+}
+
+bool offsetLess(const Vector3Int &a, const Vector3Int &b) {
+    if (a.x != b.x) return a.x < b.x;
+    if (a.y != b.y) return a.y < b.y;
+    return a.z < b.z;
+}
+
+int neighborhoodReach(const vector<Vector3Int> &offsets) {
+    // How far away the furthest neighbor is along any axis, which is how wide the halo needs to be
+    int reach = 0;
+    for (const Vector3Int &offset : offsets) {
+        reach = std::max(reach, std::max(abs(offset.x), std::max(abs(offset.y), abs(offset.z))));
+    }
+    return reach;
+}
+
+BoundaryMode boundaryFromText(const string &text) {
+    if (text == "clip") return CLIP;
+    if (text == "wrap") return WRAP;
+    if (text == "mirror") return MIRROR;
+    throw std::invalid_argument("unknown boundary '" + text + "' (expected clip, wrap or mirror)");
+}
+
+void buildTransitions(RuleSet &ruleSet) {
+    // The next hp only depends on the current hp and the neighbor count, so it is worked out once
+    // for every combination here and syncing a cell is just a lookup
+    // (other kinds of rules only need a different table)
+    size_t counts = ruleSet.survival.size();
+    ruleSet.transitions.resize((ruleSet.state + 2) * counts);
+    for (int hp = -1; hp <= ruleSet.state; hp++) {
+        for (size_t neighbors = 0; neighbors < counts; neighbors++) {
+            int next;
+            if (hp == ruleSet.state) next = ruleSet.survival[neighbors] ? hp : hp - 1; // alive
+            else if (hp < 0) next = ruleSet.spawn[neighbors] ? ruleSet.state : -1; // dead
+            else next = hp - 1; // dying
+            ruleSet.transitions[(hp + 1) * counts + neighbors] = next;
+        }
+    }
+}
+
+RuleSet makeRuleSet(const vector<size_t> &survival, const vector<size_t> &spawn, int state, const string &neighborhood,
+                    BoundaryMode boundary, const vector<Vector3Int> &customOffsets) {
+    RuleSet ruleSet;
+    neighborhoodFromText(neighborhood, ruleSet.neighborhood, ruleSet.radius);
+    ruleSet.offsets = neighborhoodOffsets(ruleSet.neighborhood, ruleSet.radius, customOffsets);
+    if (ruleSet.offsets.empty()) throw std::invalid_argument("custom neighborhood needs a neighborhoodMask");
+    if (ruleSet.neighborhood == CUSTOM) {
+        std::sort(ruleSet.offsets.begin(), ruleSet.offsets.end(), offsetLess);
+        ruleSet.offsets.erase(std::unique(ruleSet.offsets.begin(), ruleSet.offsets.end(), [](const Vector3Int &a, const Vector3Int &b) {
+            return a.x == b.x && a.y == b.y && a.z == b.z;
+        }), ruleSet.offsets.end());
+        ruleSet.radius = neighborhoodReach(ruleSet.offsets);
+    }
+    setCounts(ruleSet.survival, survival, ruleSet.offsets.size());
+    setCounts(ruleSet.spawn, spawn, ruleSet.offsets.size());
+    if (state < 0) throw std::invalid_argument("state can not be negative");
+    if (state > MAX_STATE) throw std::out_of_range("state " + std::to_string(state) + " is above " + std::to_string(MAX_STATE));
+    if ((state + 2) * ruleSet.survival.size() > MAX_TRANSITIONS) {
+        throw std::out_of_range("state " + std::to_string(state) + " with " + std::to_string(ruleSet.offsets.size()) +
+            " neighbors has too many transitions (more than " + std::to_string(MAX_TRANSITIONS) + ")");
+    }
+    ruleSet.state = state;
+    ruleSet.boundary = boundary; // not part of the notation
+    buildTransitions(ruleSet);
+    return ruleSet;
+}
+
+vector<string> splitRuleString(string text) {
+    // Same notation as the README: <survival/spawn/state/neighborhood>, ex: <9-18/5-7,12-13,15/6/M>
+    if (text.size() >= 2 && text.front() == '<' && text.back() == '>') {
+        text = text.substr(1, text.size() - 2);
+    }
+    vector<string> parts;
+    std::stringstream stream(text);
+    string part;
+    while (std::getline(stream, part, '/')) parts.push_back(part);
+    if (parts.size() != 4) {
+        throw std::invalid_argument("rule '" + text + "' needs 4 parts: survival/spawn/state/neighborhood");
+    }
+    return parts;
+}
+
+int parseState(const string &text) {
+    try {
+        size_t used;
+        int state = std::stoi(text, &used);
+        if (used != text.size() || state < 0 || state > MAX_STATE) throw std::invalid_argument("");
+        return state;
+    }
+    catch (std::logic_error&) {
+        throw std::invalid_argument("invalid state '" + text + "' (expected 0 to " + std::to_string(MAX_STATE) + ")");
+    }
+}
+
+RuleSet parseRuleString(const string &text, BoundaryMode boundary, const vector<Vector3Int> &customOffsets) {
+    vector<string> parts = splitRuleString(text);
+    // The neighborhood is known here, so the counts are checked against it before the ranges are expanded
+    NeighborType type;
+    int radius;
+    neighborhoodFromText(parts[3], type, radius);
+    size_t maxNeighbors = neighborhoodOffsets(type, radius, customOffsets).size();
+    return makeRuleSet(parseNumberList(parts[0], maxNeighbors), parseNumberList(parts[1], maxNeighbors), parseState(parts[2]), parts[3],
+                       boundary, customOffsets);
+}
+
+vector<string> expandRuleRanges(const string &rule) {
+    // "4/4/{2..5}/M" -> "4/4/2/M", "4/4/3/M", "4/4/4/M", "4/4/5/M" (multiple {a..b} multiply out)
+    size_t open = rule.find('{');
+    if (open == string::npos) return vector<string>(1, rule);
+    size_t close = rule.find('}', open);
+    size_t dots = rule.find("..", open);
+    if (close == string::npos || dots == string::npos || dots > close) {
+        throw std::invalid_argument("invalid range in rule '" + rule + "' (expected {low..high})");
+    }
+    const string invalid = "invalid range in rule '" + rule + "' (expected {low..high})";
+    string lowText = rule.substr(open + 1, dots - open - 1), highText = rule.substr(dots + 2, close - dots - 2);
+    int low, high;
+    try {
+        size_t lowUsed, highUsed;
+        low = std::stoi(lowText, &lowUsed);
+        high = std::stoi(highText, &highUsed);
+        if (lowUsed != lowText.size() || highUsed != highText.size()) throw std::invalid_argument(invalid);
+    }
+    catch (std::logic_error&) {
+        throw std::invalid_argument(invalid);
+    }
+    if (low > high) throw std::invalid_argument(invalid);
+
+    vector<string> expanded;
+    for (long long value = low; value <= high; value++) {
+        string filled = rule.substr(0, open) + std::to_string(value) + rule.substr(close + 1);
+        vector<string> rest = expandRuleRanges(filled);
+        expanded.insert(expanded.end(), rest.begin(), rest.end());
+        // Checked as it goes, so a huge range (or many ranges multiplied out) stops before it takes up all the memory
+        if (expanded.size() > MAX_EXPANDED_RULES) {
+            throw std::out_of_range("rule '" + rule + "' expands into more than " + std::to_string(MAX_EXPANDED_RULES) + " rules");
+        }
+    }
+    return expanded;
+}
+
+string ruleToString(const RuleSet &ruleSet) {
+    return "<" + numberListToString(ruleSet.survival) + "/" + numberListToString(ruleSet.spawn) + "/" +
+        std::to_string(ruleSet.state) + "/" + neighborhoodToText(ruleSet.neighborhood, ruleSet.radius) + ">";
+}
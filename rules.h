@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+
+// The highest neighbor count the rule notation takes before the neighborhood is known (Moore radius 50 has 1030300 neighbors),
+// so a typo like 0-4000000000 is caught before it is expanded
+#define MAX_NEIGHBOR_COUNT (1 << 20)
+// The biggest M and VN radius, the most that still fits MAX_NEIGHBOR_COUNT ((2 * 50 + 1)^3 - 1 = 1030300 for Moore),
+// checked before any offsets are made
+#define MAX_RADIUS 50
+// The highest state, the batch engine keeps hp (-1 to state) in int16_t windows
+#define MAX_STATE (INT16_MAX - 1)
+// The most entries a RuleSet's transitions can have ((state + 2) * (neighbors + 1)), so a big state with a big neighborhood
+// is an error instead of gigabytes of table
+#define MAX_TRANSITIONS (1 << 26)
+// The most rules a rule with {low..high} ranges can expand into
+#define MAX_EXPANDED_RULES 100000
+
+enum NeighborType {
+    MOORE,
+    VON_NEUMANN,
+    CUSTOM
+};
+
+enum BoundaryMode {
+    CLIP,
+    WRAP,
+    MIRROR
+};
+
+
+struct Vector3Int {
+    int x, y, z;
+};
+
+struct RuleSet {
+    // Indexed by neighbor count, so they are sized to the most neighbors the neighborhood can have + 1
+    vector<uint8_t> survival;
+    vector<uint8_t> spawn;
+    int state;
+    NeighborType neighborhood;
+    int radius;
+    vector<Vector3Int> offsets; // position of every neighbor relative to the cell
+    BoundaryMode boundary;
+    // Next hp for every (hp, neighbors): transitions[(hp + 1) * survival.size() + neighbors]
+    vector<int> transitions;
+};
+
+
+string textFromEnum(NeighborType nt);
+string textFromEnum(BoundaryMode bm);
+
+// "5-7,12-13,15" <-> [5, 6, 7, 12, 13, 15] (the second one from the counts a RuleSet is indexed by)
+// Throws std::out_of_range for a number above maxValue (before a range is expanded)
+vector<size_t> parseNumberList(const string &text, size_t maxValue = MAX_NEIGHBOR_COUNT);
+string numberListToString(const vector<uint8_t> &counts);
+
+void neighborhoodFromText(const string &text, NeighborType &type, int &radius);
+string neighborhoodToText(NeighborType type, int radius);
+// customOffsets is the neighborhoodMask, only used for CUSTOM
+vector<Vector3Int> neighborhoodOffsets(NeighborType type, int radius, const vector<Vector3Int> &customOffsets);
+bool offsetLess(const Vector3Int &a, const Vector3Int &b);
+BoundaryMode boundaryFromText(const string &text);
+
+// Throws std::invalid_argument or std::out_of_range when the rule doesn't make sense
+RuleSet makeRuleSet(const vector<size_t> &survival, const vector<size_t> &spawn, int state, const string &neighborhood,
+                    BoundaryMode boundary, const vector<Vector3Int> &customOffsets);
+
+// The README notation: <survival/spawn/state/neighborhood>, ex: <9-18/5-7,12-13,15/6/M>
+vector<string> splitRuleString(string text);
+int parseState(const string &text);
+RuleSet parseRuleString(const string &text, BoundaryMode boundary = CLIP, const vector<Vector3Int> &customOffsets = {});
+string ruleToString(const RuleSet &ruleSet);
+// Multiplies out the {low..high} ranges of a rule string (ex: <4/4/{2..5}/M>), used by the sweeps and the wall of simulations
+vector<string> expandRuleRanges(const string &rule);
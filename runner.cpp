@@ -0,0 +1,22 @@
+#include <iostream>
+#include <stdexcept>
+
+#include "headless.h"
+#include "instrumentation.h"
+
+
+int main(int argc, char *argv[]) {
+    // The sweeps, benchmarks and self tests without the viewer, so it builds and runs without Raylib or a display
+    traceLane = TRACE_MAIN;
+    CommandLine command;
+    try {
+        command = parseArguments(argc, argv);
+        if (!isHeadless(command)) throw std::invalid_argument("expected --sweep, --sweep-file, --bench or --selftest (the viewer is main)");
+    }
+    catch (std::exception& e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        printUsage(std::cout, "headless");
+        return EXIT_FAILURE;
+    }
+    return runHeadless(command);
+}
@@ -0,0 +1,917 @@
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "instrumentation.h"
+#include "simulation.h"
+
+using std::thread;
+
+
+using AliveMask = vector<uint8_t, FirstTouchAllocator<uint8_t>>;
+
+
+string textFromEnum(SchedulerMode sm) {
+    switch (sm) {
+        case STATIC: return "Static";
+        case STEALING: return "Stealing";
+    }
+    return "";
+}
+
+SchedulerMode schedulerFromText(const string &text) {
+    if (text == "static") return STATIC;
+    if (text == "stealing") return STEALING;
+    throw std::invalid_argument("unknown scheduler '" + text + "' (expected static or stealing)");
+}
+
+
+uint64_t cellHash(size_t index, int hp) {
+    // Dead cells hash to 0 so a generation's hash is just the sum over the non-dead cells
+    // which lets it be updated from only the cells that changed (see syncCells)
+    if (hp < 0) return 0;
+    uint64_t x = index * 0x9E3779B97F4A7C15ull + (uint64_t)hp;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+
+int CycleDetector::add(uint64_t hash, int tick) {
+    size_t stored = std::min<size_t>(count, CYCLE_HISTORY);
+    // The ticks aren't always 1 apart (see ticksPerBatch), so the generation a period ago is looked up by its tick
+    for (size_t back = 1; period > 0 && back <= stored; back++) {
+        size_t slot = (count - back) % CYCLE_HISTORY;
+        if (ticks[slot] != tick - period) continue;
+        if (hashes[slot] != hash) period = 0; // only possible with a hash collision
+        break;
+    }
+    for (size_t back = 1; period == 0 && back <= stored; back++) {
+        size_t slot = (count - back) % CYCLE_HISTORY;
+        if (hashes[slot] == hash) {
+            period = tick - ticks[slot];
+            cycleStart = ticks[slot];
+        }
+    }
+    hashes[count % CYCLE_HISTORY] = hash;
+    ticks[count % CYCLE_HISTORY] = tick;
+    count++;
+    return period;
+}
+
+void CyclePlayback::record(const CellVector &cells, const TickStats &stats, int detectedPeriod) {
+    if (detectedPeriod != period) reset();
+    if (detectedPeriod == 0 || (size_t)detectedPeriod * cells.size() * sizeof(int) > PLAYBACK_MAX_BYTES) return;
+    period = detectedPeriod;
+
+    vector<int> hp(cells.size());
+    for (size_t i = 0; i < cells.size(); i++) hp[i] = cells[i].getHp();
+    generations.push_back(hp);
+    generationStats.push_back(stats);
+}
+
+TickStats CyclePlayback::play(CellVector &cells) {
+    const vector<int> &hp = generations[next];
+    if (period > 1) {
+        // With a steady state the cells are already the next generation
+        for (size_t i = 0; i < cells.size(); i++) cells[i].setHp(hp[i]);
+    }
+    const TickStats &stats = generationStats[next];
+    next = (next + 1) % period;
+    return stats;
+}
+
+
+void syncCells(CellVector &cells, size_t start, size_t end, const RuleSet &rules, TickStats &stats) {
+    // Counts (and the change to the hash) are added to the thread's stats, which are added together after the join
+    size_t alive = 0, dead = 0;
+    for (size_t i = start; i < end; i++) {
+        int oldHp = cells[i].getHp();
+        cells[i].sync(rules);
+        int hp = cells[i].getHp();
+        alive += hp == rules.state;
+        dead += hp < 0;
+        if (hp != oldHp) stats.hash += cellHash(i, hp) - cellHash(i, oldHp);
+    }
+    stats.aliveCells += alive;
+    stats.deadCells += dead;
+    stats.dyingCells += (end - start) - alive - dead;
+}
+
+int ghostSource(int i, int bounds, BoundaryMode boundary) {
+    // Which cell a ghost (halo) cell outside of [0, bounds) copies (any distance away, see updateCellsBatch)
+    if (boundary == WRAP) return ((i % bounds) + bounds) % bounds;
+    // MIRROR, the edge cell is repeated: the cells and their reflection repeat every 2 * bounds
+    int reflected = ((i % (2 * bounds)) + 2 * bounds) % (2 * bounds);
+    return reflected < bounds ? reflected : 2 * bounds - 1 - reflected;
+}
+
+int slabStart(size_t i, size_t threadCount, int bounds) {
+    // Worker i's x slab is [slabStart(i), slabStart(i + 1)), whole columns of tiles, which is the part it first touches
+    // (see createCells), fills the mask for, and starts out with the tiles of
+    int tilesX = (bounds + TILE_SIZE - 1) / TILE_SIZE;
+    return std::min((int)(i * tilesX / threadCount) * TILE_SIZE, bounds);
+}
+
+void pinThread(thread &worker, size_t i, size_t threadCount, bool pin) {
+    // With pin (pinThreads), worker i always runs on the same CPU, so it stays next to the memory it first touched
+    // The workers are spread evenly over the CPUs in order, so neighboring slabs are on neighboring CPUs
+    // (and the same NUMA node when the CPUs are numbered by node, like on Linux)
+#ifdef __linux__
+    if (!pin) return;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+    vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+    }
+    if (cpus.empty()) return;
+    cpu_set_t pinned;
+    CPU_ZERO(&pinned);
+    CPU_SET(cpus[i * cpus.size() / threadCount], &pinned);
+    pthread_setaffinity_np(worker.native_handle(), sizeof(pinned), &pinned);
+#else
+    (void)worker, (void)i, (void)threadCount, (void)pin;
+#endif
+}
+
+template <typename Work>
+void forEachIndexedSlab(size_t threadCount, int bounds, bool pin, Work work) {
+    // Runs work(i, start, end) on every worker's x slab, each on its own thread (inline when there is only 1)
+    if (threadCount <= 1) {
+        work(0, 0, bounds);
+        return;
+    }
+    vector<thread> workers(threadCount);
+    for (size_t i = 0; i < threadCount; i++) {
+        workers[i] = thread([&work, i, threadCount, bounds]() {
+            traceLane = TRACE_WORKERS + i;
+            work(i, slabStart(i, threadCount, bounds), slabStart(i + 1, threadCount, bounds));
+        });
+        pinThread(workers[i], i, threadCount, pin);
+    }
+    for (size_t i = 0; i < threadCount; i++) {
+        workers[i].join();
+    }
+}
+
+template <typename Work>
+void forEachSlab(size_t threadCount, int bounds, bool pin, Work work) {
+    forEachIndexedSlab(threadCount, bounds, pin, [&work](size_t, int start, int end) { work(start, end); });
+}
+
+void forEachUpdateThread(const SimulationConfig &config, const std::function<void(size_t, int, int)> &work) {
+    forEachIndexedSlab(std::max<size_t>(config.threads, 1), config.cellBounds, config.pinThreads, work);
+}
+
+struct Tile {
+    // A column of cells (every z) that is counted and synced as 1 piece of work
+    int xStart, xEnd, yStart, yEnd;
+};
+
+vector<Tile> makeTiles(int bounds) {
+    // In x then y order, so a thread's share of them is close together in memory
+    vector<Tile> tiles;
+    for (int x = 0; x < bounds; x += TILE_SIZE) {
+        for (int y = 0; y < bounds; y += TILE_SIZE) {
+            tiles.push_back({ x, std::min(x + TILE_SIZE, bounds), y, std::min(y + TILE_SIZE, bounds) });
+        }
+    }
+    return tiles;
+}
+
+vector<vector<int>> tileReach(int bounds, int halo, BoundaryMode boundary) {
+    // For every row of tiles along an axis, the rows of tiles that have a cell within halo of it (after wrapping/mirroring)
+    int tiles = (bounds + TILE_SIZE - 1) / TILE_SIZE;
+    vector<vector<int>> reach(tiles);
+    for (int t = 0; t < tiles; t++) {
+        int end = std::min((t + 1) * TILE_SIZE, bounds) + halo;
+        for (int i = t * TILE_SIZE - halo; i < end; i++) {
+            bool ghost = i < 0 || i >= bounds;
+            if (ghost && boundary == CLIP) continue;
+            int source = (ghost ? ghostSource(i, bounds, boundary) : i) / TILE_SIZE;
+            if (std::find(reach[t].begin(), reach[t].end(), source) == reach[t].end()) reach[t].push_back(source);
+        }
+    }
+    return reach;
+}
+
+void fillAliveMask(const CellVector &cells, AliveMask &mask, vector<uint8_t> &tileActivity, int bounds, int halo, int state, BoundaryMode boundary, int start, int end) {
+    // The mask is (bounds + 2 * halo)^3 with 1 = alive, the halo around the outside is what makes the
+    // neighbor counting branchless: with CLIP it is 0, otherwise it is a copy of the cells it wraps/mirrors to
+    // Each thread fills its own x slab (and the y/z halo of it), and any x halo planes that are copies of its slab
+    // (or with CLIP, the x halo planes next to it), so every byte is written by the thread that uses it
+    // The slabs line up with the tiles, so each thread also marks which of its tiles have alive (1) and non dead (2) cells
+    size_t pad = bounds + 2 * halo;
+    int tilesY = (bounds + TILE_SIZE - 1) / TILE_SIZE;
+    for (int x = start; x < end; x++) {
+        uint8_t *plane = &mask[(x + halo) * pad * pad];
+        for (int y = 0; y < bounds; y++) {
+            uint8_t *row = plane + (y + halo) * pad + halo;
+            size_t oneIdx = threeToOne(x, y, 0, bounds);
+            uint8_t alive = 0, live = 0;
+            for (int z = 0; z < bounds; z++) {
+                int hp = cells[oneIdx + z].getHp();
+                row[z] = hp == state;
+                alive |= row[z];
+                live |= hp >= 0;
+            }
+            tileActivity[(x / TILE_SIZE) * tilesY + y / TILE_SIZE] |= alive | live << 1;
+            for (int h = 1; h <= halo; h++) {
+                row[-h] = boundary == CLIP ? 0 : row[ghostSource(-h, bounds, boundary)];
+                row[bounds - 1 + h] = boundary == CLIP ? 0 : row[ghostSource(bounds - 1 + h, bounds, boundary)];
+            }
+        }
+        for (int h = 1; h <= halo; h++) {
+            // Whole rows (including the z halo) so the edges and corners are filled too
+            if (boundary == CLIP) {
+                std::fill_n(plane + (halo - h) * pad, pad, 0);
+                std::fill_n(plane + (bounds - 1 + halo + h) * pad, pad, 0);
+                continue;
+            }
+            std::copy_n(plane + (ghostSource(-h, bounds, boundary) + halo) * pad, pad, plane + (halo - h) * pad);
+            std::copy_n(plane + (ghostSource(bounds - 1 + h, bounds, boundary) + halo) * pad, pad, plane + (bounds - 1 + halo + h) * pad);
+        }
+    }
+    for (int h = 1; h <= halo; h++) {
+        uint8_t *lowPlane = &mask[(halo - h) * pad * pad];
+        uint8_t *highPlane = &mask[(bounds - 1 + halo + h) * pad * pad];
+        if (boundary == CLIP) {
+            if (start == 0 && end > start) std::fill_n(lowPlane, pad * pad, 0);
+            if (end == bounds && end > start) std::fill_n(highPlane, pad * pad, 0);
+            continue;
+        }
+        int low = ghostSource(-h, bounds, boundary);
+        int high = ghostSource(bounds - 1 + h, bounds, boundary);
+        if (low >= start && low < end) {
+            std::copy_n(&mask[(low + halo) * pad * pad], pad * pad, lowPlane);
+        }
+        if (high >= start && high < end) {
+            std::copy_n(&mask[(high + halo) * pad * pad], pad * pad, highPlane);
+        }
+    }
+}
+
+void updateNeighbors(CellVector &cells, const AliveMask &mask, int bounds, int halo, const Tile &tile, const long maskOffsets[], size_t totalOffsets) {
+    // No bounds checks needed, every offset from a cell lands inside the padded mask
+    size_t pad = bounds + 2 * halo;
+    for (int x = tile.xStart; x < tile.xEnd; x++) {
+        for (int y = tile.yStart; y < tile.yEnd; y++) {
+            const uint8_t *row = &mask[((x + halo) * pad + y + halo) * pad + halo];
+            size_t oneIdx = threeToOne(x, y, 0, bounds);
+            for (int z = 0; z < bounds; z++) {
+                size_t neighbors = 0;
+                for (size_t i = 0; i < totalOffsets; i++) {
+                    neighbors += row[z + maskOffsets[i]];
+                }
+                cells[oneIdx + z].setNeighbors(neighbors);
+            }
+        }
+    }
+}
+
+template <NeighborType TYPE>
+struct FixedNeighborhood;
+
+// Radius 1 neighborhoods with everything but the mask width known at compile time, so the sums get unrolled
+// and, since the counts fit in a byte (at most 26), the z loop can be vectorized
+template <>
+struct FixedNeighborhood<MOORE> {
+    static void countRow(const uint8_t *center, size_t rowStride, size_t planeStride, int length, uint8_t *counts) {
+        const uint8_t *rows[9];
+        for (int dx = -1, k = 0; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++, k++) rows[k] = center + dx * (long)planeStride + dy * (long)rowStride;
+        }
+        for (int z = 0; z < length; z++) {
+            uint8_t sum = 0;
+            for (int k = 0; k < 9; k++) sum += rows[k][z - 1] + rows[k][z] + rows[k][z + 1];
+            counts[z] = sum - center[z];
+        }
+    }
+};
+
+template <>
+struct FixedNeighborhood<VON_NEUMANN> {
+    static void countRow(const uint8_t *center, size_t rowStride, size_t planeStride, int length, uint8_t *counts) {
+        const uint8_t *left = center - planeStride;
+        const uint8_t *right = center + planeStride;
+        const uint8_t *down = center - rowStride;
+        const uint8_t *up = center + rowStride;
+        for (int z = 0; z < length; z++) {
+            counts[z] = left[z] + right[z] + down[z] + up[z] + center[z - 1] + center[z + 1];
+        }
+    }
+};
+
+template <NeighborType TYPE>
+void updateNeighborsFixed(CellVector &cells, const AliveMask &mask, int bounds, const Tile &tile) {
+    size_t pad = bounds + 2;
+    vector<uint8_t> counts(bounds);
+    for (int x = tile.xStart; x < tile.xEnd; x++) {
+        for (int y = tile.yStart; y < tile.yEnd; y++) {
+            FixedNeighborhood<TYPE>::countRow(&mask[((x + 1) * pad + y + 1) * pad + 1], pad, pad * pad, bounds, counts.data());
+            size_t oneIdx = threeToOne(x, y, 0, bounds);
+            for (int z = 0; z < bounds; z++) cells[oneIdx + z].setNeighbors(counts[z]);
+        }
+    }
+}
+
+void updateNeighborsBox(CellVector &cells, const AliveMask &mask, int bounds, int radius, const Tile &tile) {
+    // A Moore neighborhood is a box, so it can be summed 1 axis at a time (z, then y, then x) with sliding windows
+    // which costs the same per cell no matter how big the radius is (the box includes the cell itself, so it is taken off)
+    // The sums cover the tile plus radius on each side in x and y
+    size_t pad = bounds + 2 * radius;
+    size_t width = 2 * radius + 1;
+    size_t planes = tile.xEnd - tile.xStart + 2 * radius;
+    size_t cols = tile.yEnd - tile.yStart;
+    size_t rows = cols + 2 * radius;
+    size_t plane = cols * bounds;
+
+    vector<uint32_t> zSums(planes * rows * bounds);
+    for (size_t p = 0; p < planes; p++) {
+        for (size_t r = 0; r < rows; r++) {
+            const uint8_t *row = &mask[((tile.xStart + p) * pad + tile.yStart + r) * pad];
+            uint32_t *sums = &zSums[(p * rows + r) * bounds];
+            uint32_t sum = 0;
+            for (size_t z = 0; z < width; z++) sum += row[z];
+            sums[0] = sum;
+            for (int z = 1; z < bounds; z++) {
+                sum += row[z + width - 1] - row[z - 1];
+                sums[z] = sum;
+            }
+        }
+    }
+
+    vector<uint32_t> ySums(planes * plane);
+    for (size_t p = 0; p < planes; p++) {
+        const uint32_t *sumRows = &zSums[p * rows * bounds];
+        uint32_t *sums = &ySums[p * plane];
+        for (size_t r = 0; r < width; r++) {
+            for (int z = 0; z < bounds; z++) sums[z] += sumRows[r * bounds + z];
+        }
+        for (size_t y = 1; y < cols; y++) {
+            for (int z = 0; z < bounds; z++) {
+                sums[y * bounds + z] = sums[(y - 1) * bounds + z] + sumRows[(y + width - 1) * bounds + z] - sumRows[(y - 1) * bounds + z];
+            }
+        }
+    }
+
+    vector<uint32_t> xSums(plane, 0);
+    for (size_t p = 0; p < width; p++) {
+        for (size_t i = 0; i < plane; i++) xSums[i] += ySums[p * plane + i];
+    }
+    for (int x = tile.xStart; x < tile.xEnd; x++) {
+        size_t p = x - tile.xStart;
+        if (p > 0) {
+            for (size_t i = 0; i < plane; i++) xSums[i] += ySums[(p + width - 1) * plane + i] - ySums[(p - 1) * plane + i];
+        }
+        for (int y = tile.yStart; y < tile.yEnd; y++) {
+            const uint8_t *self = &mask[((x + radius) * pad + y + radius) * pad + radius];
+            const uint32_t *sums = &xSums[(y - tile.yStart) * bounds];
+            size_t oneIdx = threeToOne(x, y, 0, bounds);
+            for (int z = 0; z < bounds; z++) {
+                cells[oneIdx + z].setNeighbors(sums[z] - self[z]);
+            }
+        }
+    }
+}
+
+struct ZRun {
+    // The neighbors in row (x + dx, y + dy) from z + zLow to z + zHigh
+    int dx, dy, zLow, zHigh;
+};
+
+vector<ZRun> neighborhoodRuns(vector<Vector3Int> offsets) {
+    std::sort(offsets.begin(), offsets.end(), offsetLess);
+    vector<ZRun> runs;
+    for (const Vector3Int &offset : offsets) {
+        if (!runs.empty() && runs.back().dx == offset.x && runs.back().dy == offset.y && runs.back().zHigh + 1 == offset.z) {
+            runs.back().zHigh++;
+        }
+        else {
+            runs.push_back({ offset.x, offset.y, offset.z, offset.z });
+        }
+    }
+    return runs;
+}
+
+void updateNeighborsRuns(CellVector &cells, const AliveMask &mask, int bounds, int halo, const Tile &tile, const vector<ZRun> &runs) {
+    // Any neighborhood can be split into runs along z, and with prefix sums along z each run is 2 lookups
+    // so a von Neumann neighborhood costs O(radius^2) per cell instead of O(radius^3)
+    size_t pad = bounds + 2 * halo;
+    size_t planes = tile.xEnd - tile.xStart + 2 * halo;
+    size_t rows = tile.yEnd - tile.yStart + 2 * halo;
+    vector<uint32_t> prefix(planes * rows * (pad + 1));
+    for (size_t p = 0; p < planes; p++) {
+        for (size_t r = 0; r < rows; r++) {
+            const uint8_t *row = &mask[((tile.xStart + p) * pad + tile.yStart + r) * pad];
+            uint32_t *sums = &prefix[(p * rows + r) * (pad + 1)];
+            sums[0] = 0;
+            for (size_t z = 0; z < pad; z++) sums[z + 1] = sums[z] + row[z];
+        }
+    }
+
+    vector<uint32_t> counts(bounds);
+    for (int x = tile.xStart; x < tile.xEnd; x++) {
+        for (int y = tile.yStart; y < tile.yEnd; y++) {
+            std::fill(counts.begin(), counts.end(), 0);
+            for (const ZRun &run : runs) {
+                const uint32_t *sums = &prefix[((x - tile.xStart + halo + run.dx) * rows + y - tile.yStart + halo + run.dy) * (pad + 1)];
+                const uint32_t *high = sums + halo + run.zHigh + 1;
+                const uint32_t *low = sums + halo + run.zLow;
+                for (int z = 0; z < bounds; z++) counts[z] += high[z] - low[z];
+            }
+            size_t oneIdx = threeToOne(x, y, 0, bounds);
+            for (int z = 0; z < bounds; z++) cells[oneIdx + z].setNeighbors(counts[z]);
+        }
+    }
+}
+
+class TileQueue {
+    // A thread's share of the tiles: it takes them from the back, other threads steal from the front
+private:
+    std::mutex lock;
+    std::deque<size_t> tiles;
+public:
+    void push(size_t tile) {
+        std::lock_guard<std::mutex> guard(lock);
+        tiles.push_back(tile);
+    }
+    bool pop(size_t &tile) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (tiles.empty()) return false;
+        tile = tiles.back();
+        tiles.pop_back();
+        return true;
+    }
+    bool steal(size_t &tile) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (tiles.empty()) return false;
+        tile = tiles.front();
+        tiles.pop_front();
+        return true;
+    }
+};
+
+template <typename Work>
+void runTiles(size_t threadCount, int bounds, SchedulerMode mode, bool pin, Work work, vector<double> *threadBusy) {
+    // Every thread starts with the tiles of its own x slab (the same split as STATIC)
+    // With STEALING, a thread that runs out takes tiles from the other threads until there are none left
+    // No tiles are added once it starts, so a thread that finds every queue empty is done
+    vector<TileQueue> queues(threadCount);
+    size_t tilesY = (bounds + TILE_SIZE - 1) / TILE_SIZE;
+    for (size_t i = 0; i < threadCount; i++) {
+        size_t first = slabStart(i, threadCount, bounds) / TILE_SIZE * tilesY;
+        size_t last = (slabStart(i + 1, threadCount, bounds) + TILE_SIZE - 1) / TILE_SIZE * tilesY;
+        for (size_t tile = first; tile < last; tile++) queues[i].push(tile);
+    }
+    auto worker = [&](size_t i) {
+        TraceSpan span(PHASE_TILES);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t tile;
+        while (queues[i].pop(tile)) work(i, tile);
+        if (mode == STEALING) {
+            for (size_t offset = 1; offset < threadCount; offset++) {
+                size_t victim = (i + offset) % threadCount;
+                while (queues[victim].steal(tile)) work(i, tile);
+            }
+        }
+        if (threadBusy) (*threadBusy)[i] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    if (threadCount == 1) {
+        worker(0);
+        return;
+    }
+    vector<thread> workers(threadCount);
+    for (size_t i = 0; i < threadCount; i++) {
+        workers[i] = thread([&worker, i]() {
+            traceLane = TRACE_WORKERS + i;
+            worker(i);
+        });
+        pinThread(workers[i], i, threadCount, pin);
+    }
+    for (size_t i = 0; i < threadCount; i++) workers[i].join();
+}
+
+TickStats updateCells(CellVector &cells, const SimulationConfig &config, uint64_t previousHash, vector<double> *threadBusy) {
+    const RuleSet &rules = config.rules;
+    const int bounds = config.cellBounds;
+    const size_t threadCount = std::max<size_t>(config.threads, 1);
+    // Small neighborhoods (like radius 1) just add up every offset, bigger ones use sums that
+    // don't grow with the volume of the neighborhood
+    const int halo = rules.radius;
+    long pad = bounds + 2 * halo;
+    size_t totalOffsets = rules.offsets.size();
+    vector<long> maskOffsets(totalOffsets);
+    for (size_t i = 0; i < totalOffsets; i++) {
+        maskOffsets[i] = (rules.offsets[i].x * pad + rules.offsets[i].y) * pad + rules.offsets[i].z;
+    }
+    // Picked once per tick rather than per cell
+    bool fixed = config.specializedKernels && rules.radius == 1 && rules.neighborhood != CUSTOM;
+    bool direct = totalOffsets <= DIRECT_KERNEL_MAX_OFFSETS;
+    bool box = !direct && rules.neighborhood == MOORE;
+    vector<ZRun> runs;
+    if (!direct && !box) runs = neighborhoodRuns(rules.offsets);
+    AliveMask mask(pad * pad * pad); // not zeroed, fillAliveMask writes all of it
+
+    const vector<Tile> tiles = makeTiles(bounds);
+    int tilesY = (bounds + TILE_SIZE - 1) / TILE_SIZE;
+    vector<uint8_t> tileActivity(tiles.size(), 0);
+    const vector<vector<int>> reach = tileReach(bounds, halo, rules.boundary);
+    if (threadBusy) threadBusy->resize(threadCount, 0);
+
+    // Step 1: every thread fills the alive mask for its x slab (whole columns of tiles)
+    // Step 2: the tiles are counted and synced, skipping any that can't change: every cell in it is dead and
+    // no tile within reach has an alive cell (unless dead cells with 0 neighbors spawn)
+    // Sparse or centered patterns leave most of the work in a few tiles, which is what the stealing is for
+    // (the mask is a copy of the old states, so a tile can be synced as soon as it is counted)
+    vector<TickStats> threadStats(threadCount, { 0, 0, 0, 0 });
+    // Counting and syncing are timed per tile (only when profiling or tracing), and added up over the threads
+    const bool timed = profiling, traced = tracing;
+    vector<double> countSeconds(threadCount, 0), syncSeconds(threadCount, 0);
+    auto countAndSync = [&](size_t i, size_t t) {
+        const Tile &tile = tiles[t];
+        int tx = t / tilesY, ty = t % tilesY;
+        bool quiet = !rules.spawn[0] && !(tileActivity[t] & 2);
+        for (size_t r = 0; quiet && r < reach[tx].size(); r++) {
+            for (int y : reach[ty]) quiet = quiet && !(tileActivity[reach[tx][r] * tilesY + y] & 1);
+        }
+        if (quiet) {
+            threadStats[i].deadCells += (size_t)(tile.xEnd - tile.xStart) * (tile.yEnd - tile.yStart) * bounds;
+            return;
+        }
+        int64_t start = 0, counted = 0;
+        if (timed || traced) start = TraceRecorder::now();
+        if (fixed && rules.neighborhood == MOORE) updateNeighborsFixed<MOORE>(cells, mask, bounds, tile);
+        else if (fixed) updateNeighborsFixed<VON_NEUMANN>(cells, mask, bounds, tile);
+        else if (direct) updateNeighbors(cells, mask, bounds, halo, tile, maskOffsets.data(), totalOffsets);
+        else if (box) updateNeighborsBox(cells, mask, bounds, halo, tile);
+        else updateNeighborsRuns(cells, mask, bounds, halo, tile, runs);
+        if (timed || traced) counted = TraceRecorder::now();
+        for (int x = tile.xStart; x < tile.xEnd; x++) {
+            syncCells(cells, threeToOne(x, tile.yStart, 0, bounds), threeToOne(x, tile.yEnd, 0, bounds), rules, threadStats[i]);
+        }
+        if (timed || traced) {
+            int64_t synced = TraceRecorder::now();
+            countSeconds[i] += (counted - start) / 1e9;
+            syncSeconds[i] += (synced - counted) / 1e9;
+            if (traced) {
+                traceRecorder.record(PHASE_COUNT, start, counted);
+                traceRecorder.record(PHASE_SYNC, counted, synced);
+            }
+        }
+    };
+
+    // With 1 thread (the sweep workers) it is all done inline, no point in spawning a thread just to join it
+    {
+        ScopedTimer timer(PHASE_MASK);
+        forEachSlab(threadCount, bounds, config.pinThreads, [&](int start, int end) {
+            TraceSpan span(PHASE_MASK);
+            fillAliveMask(cells, mask, tileActivity, bounds, halo, rules.state, rules.boundary, start, end);
+        });
+    }
+    {
+        ScopedTimer timer(PHASE_TILES);
+        runTiles(threadCount, bounds, config.scheduler, config.pinThreads, countAndSync, threadBusy);
+    }
+    if (timed) {
+        double count = 0, sync = 0;
+        for (size_t i = 0; i < threadCount; i++) {
+            count += countSeconds[i];
+            sync += syncSeconds[i];
+        }
+        phaseTimes.add(PHASE_COUNT, count);
+        phaseTimes.add(PHASE_SYNC, sync);
+    }
+    TickStats stats = { 0, 0, 0, previousHash };
+    for (size_t i = 0; i < threadCount; i++) {
+        stats.aliveCells += threadStats[i].aliveCells;
+        stats.dyingCells += threadStats[i].dyingCells;
+        stats.deadCells += threadStats[i].deadCells;
+        stats.hash += threadStats[i].hash;
+    }
+    return stats;
+}
+
+
+bool canBatch(const RuleSet &rules) {
+    // The batched update works on small neighborhoods (the halo it copies grows by the radius every generation)
+    // With MIRROR the copies of the cells past the edge are flipped, so the neighborhood has to be symmetric
+    if (rules.offsets.size() > DIRECT_KERNEL_MAX_OFFSETS || rules.state > INT16_MAX - 1) return false;
+    if (rules.boundary != MIRROR || rules.neighborhood != CUSTOM) return true;
+    for (const Vector3Int &offset : rules.offsets) {
+        const Vector3Int flips[] = { { -offset.x, offset.y, offset.z }, { offset.x, -offset.y, offset.z }, { offset.x, offset.y, -offset.z } };
+        for (const Vector3Int &flip : flips) {
+            if (!std::binary_search(rules.offsets.begin(), rules.offsets.end(), flip, offsetLess)) return false;
+        }
+    }
+    return true;
+}
+
+struct BatchWindow {
+    // A thread's copy of the tile it is working on, with generations * radius extra cells on every side (the halo)
+    vector<int16_t> current;
+    vector<int16_t> next;
+    vector<uint8_t> alive;
+    vector<uint8_t> counts;
+};
+
+void advanceTile(CellVector &cells, const vector<int16_t, FirstTouchAllocator<int16_t>> &source, const RuleSet &rules, int bounds,
+                 const Tile &tile, int generations, bool fixed, BatchWindow &window, TickStats &stats) {
+    // Every generation, the part of the window that is still correct shrinks by the radius on every side
+    // (the cells at the edge are missing neighbors), so after all of them only the tile itself is left
+    // Cells past the edge of the grid are copies of the cells they wrap/mirror to, and are updated like any other,
+    // except with CLIP where they stay dead
+    const int radius = rules.radius;
+    const int halo = generations * radius;
+    const int start[3] = { tile.xStart - halo, tile.yStart - halo, -halo };
+    const int size[3] = { tile.xEnd - tile.xStart + 2 * halo, tile.yEnd - tile.yStart + 2 * halo, bounds + 2 * halo };
+    const size_t rowStride = size[2];
+    const size_t planeStride = (size_t)size[1] * size[2];
+    const size_t total = size[0] * planeStride;
+    window.current.resize(total);
+    window.next.resize(total);
+    window.alive.resize(total);
+    window.counts.resize(size[2]);
+
+    // The part of the window that is real cells (all of it, unless CLIP)
+    int inside[3][2];
+    for (int axis = 0; axis < 3; axis++) {
+        inside[axis][0] = rules.boundary == CLIP ? std::max(0, -start[axis]) : 0;
+        inside[axis][1] = rules.boundary == CLIP ? std::min(size[axis], bounds - start[axis]) : size[axis];
+    }
+    auto sourceOf = [&](int i) { return i >= 0 && i < bounds ? i : ghostSource(i, bounds, rules.boundary); };
+    bool live = false;
+    for (int x = 0; x < size[0]; x++) {
+        for (int y = 0; y < size[1]; y++) {
+            int16_t *row = &window.current[x * planeStride + y * rowStride];
+            bool real = x >= inside[0][0] && x < inside[0][1] && y >= inside[1][0] && y < inside[1][1];
+            if (!real) {
+                std::fill_n(row, size[2], -1);
+                continue;
+            }
+            const int16_t *sourceRow = &source[threeToOne(sourceOf(start[0] + x), sourceOf(start[1] + y), 0, bounds)];
+            for (int z = 0; z < size[2]; z++) {
+                row[z] = z >= inside[2][0] && z < inside[2][1] ? sourceRow[sourceOf(z - halo)] : -1;
+                live |= row[z] >= 0;
+            }
+        }
+    }
+    if (!live && !rules.spawn[0]) {
+        // Same as the tiles updateCells skips: nothing within reach that isn't dead, so nothing changes
+        stats.deadCells += (size_t)(tile.xEnd - tile.xStart) * (tile.yEnd - tile.yStart) * bounds;
+        return;
+    }
+    window.next = window.current; // so the cells past a CLIP edge are dead in both
+
+    long windowOffsets[DIRECT_KERNEL_MAX_OFFSETS];
+    size_t totalOffsets = rules.offsets.size();
+    for (size_t i = 0; i < totalOffsets; i++) {
+        windowOffsets[i] = rules.offsets[i].x * (long)planeStride + rules.offsets[i].y * (long)rowStride + rules.offsets[i].z;
+    }
+    const size_t counts = rules.survival.size();
+    for (int generation = 1; generation <= generations; generation++) {
+        // The alive mask only needs what this generation reads, and this generation only updates what is still correct
+        int readLow = (generation - 1) * radius;
+        for (int x = readLow; x < size[0] - readLow; x++) {
+            for (int y = readLow; y < size[1] - readLow; y++) {
+                size_t rowStart = x * planeStride + y * rowStride;
+                for (int z = readLow; z < size[2] - readLow; z++) {
+                    window.alive[rowStart + z] = window.current[rowStart + z] == rules.state;
+                }
+            }
+        }
+        int low[3], high[3];
+        for (int axis = 0; axis < 3; axis++) {
+            low[axis] = std::max(generation * radius, inside[axis][0]);
+            high[axis] = std::min(size[axis] - generation * radius, inside[axis][1]);
+        }
+        uint8_t *rowCounts = window.counts.data();
+        for (int x = low[0]; x < high[0]; x++) {
+            for (int y = low[1]; y < high[1]; y++) {
+                size_t rowStart = x * planeStride + y * rowStride + low[2];
+                const uint8_t *center = &window.alive[rowStart];
+                int length = high[2] - low[2];
+                if (fixed && rules.neighborhood == MOORE) FixedNeighborhood<MOORE>::countRow(center, rowStride, planeStride, length, rowCounts);
+                else if (fixed) FixedNeighborhood<VON_NEUMANN>::countRow(center, rowStride, planeStride, length, rowCounts);
+                else {
+                    for (int z = 0; z < length; z++) {
+                        uint8_t neighbors = 0;
+                        for (size_t i = 0; i < totalOffsets; i++) neighbors += center[z + windowOffsets[i]];
+                        rowCounts[z] = neighbors;
+                    }
+                }
+                const int16_t *hp = &window.current[rowStart];
+                int16_t *nextHp = &window.next[rowStart];
+                for (int z = 0; z < length; z++) nextHp[z] = rules.transitions[(hp[z] + 1) * counts + rowCounts[z]];
+            }
+        }
+        std::swap(window.current, window.next);
+    }
+
+    size_t alive = 0, dead = 0;
+    for (int x = tile.xStart; x < tile.xEnd; x++) {
+        for (int y = tile.yStart; y < tile.yEnd; y++) {
+            const int16_t *row = &window.current[(x - start[0]) * planeStride + (y - start[1]) * rowStride + halo];
+            size_t oneIdx = threeToOne(x, y, 0, bounds);
+            for (int z = 0; z < bounds; z++) {
+                int hp = row[z];
+                int oldHp = source[oneIdx + z];
+                cells[oneIdx + z].setHp(hp);
+                alive += hp == rules.state;
+                dead += hp < 0;
+                if (hp != oldHp) stats.hash += cellHash(oneIdx + z, hp) - cellHash(oneIdx + z, oldHp);
+            }
+        }
+    }
+    stats.aliveCells += alive;
+    stats.deadCells += dead;
+    stats.dyingCells += (size_t)(tile.xEnd - tile.xStart) * (tile.yEnd - tile.yStart) * bounds - alive - dead;
+}
+
+TickStats updateCellsBatch(CellVector &cells, const SimulationConfig &config, int generations, uint64_t previousHash, vector<double> *threadBusy) {
+    // Temporal blocking: updateCells reads and writes every cell once per tick, this copies a tile (and enough
+    // cells around it) into a small window that stays in cache and does all the generations there, so the cells
+    // are only read and written once per batch. The cells in the halo are worked out by more than 1 tile, which
+    // costs some extra counting but means the tiles don't have to wait for each other
+    // Only the last generation's stats (and hash) are returned
+    const RuleSet &rules = config.rules;
+    const int bounds = config.cellBounds;
+    const size_t threadCount = std::max<size_t>(config.threads, 1);
+    if (generations <= 1 || !canBatch(rules)) {
+        TickStats stats = { 0, 0, 0, previousHash };
+        for (int generation = 0; generation < std::max(generations, 1); generation++) {
+            stats = updateCells(cells, config, stats.hash, threadBusy);
+        }
+        return stats;
+    }
+    // The old hps, since a tile's halo is another tile's cells
+    vector<int16_t, FirstTouchAllocator<int16_t>> source(cells.size());
+    forEachSlab(threadCount, bounds, config.pinThreads, [&](int start, int end) {
+        for (size_t i = threeToOne(start, 0, 0, bounds); i < threeToOne(end, 0, 0, bounds); i++) source[i] = cells[i].getHp();
+    });
+
+    const vector<Tile> tiles = makeTiles(bounds);
+    const bool fixed = config.specializedKernels && rules.radius == 1 && rules.neighborhood != CUSTOM;
+    vector<BatchWindow> windows(threadCount);
+    vector<TickStats> threadStats(threadCount, { 0, 0, 0, 0 });
+    if (threadBusy) threadBusy->resize(threadCount, 0);
+    {
+        ScopedTimer timer(PHASE_TILES);
+        runTiles(threadCount, bounds, config.scheduler, config.pinThreads, [&](size_t i, size_t t) {
+            advanceTile(cells, source, rules, bounds, tiles[t], generations, fixed, windows[i], threadStats[i]);
+        }, threadBusy);
+    }
+
+    TickStats stats = { 0, 0, 0, previousHash };
+    for (size_t i = 0; i < threadCount; i++) {
+        stats.aliveCells += threadStats[i].aliveCells;
+        stats.dyingCells += threadStats[i].dyingCells;
+        stats.deadCells += threadStats[i].deadCells;
+        stats.hash += threadStats[i].hash;
+    }
+    return stats;
+}
+
+uint64_t hashCells(const CellVector &cells) {
+    uint64_t hash = 0;
+    for (size_t i = 0; i < cells.size(); i++) {
+        hash += cellHash(i, cells[i].getHp());
+    }
+    return hash;
+}
+
+
+TickStats randomizeCells(CellVector &cells, int bounds, int state, float aliveChance, std::mt19937 &rng) {
+    for (size_t i = 0; i < cells.size(); i++) {
+        cells[i].reset();
+    }
+    TickStats stats = { 0, 0, cells.size(), 0 };
+    std::bernoulli_distribution spawnRoll(aliveChance);
+    // Only middle section has a spawn chance
+    for (int x = bounds/3.0f; x < bounds * 2.0f/3.0f; x++) {
+        for (int y = bounds/3.0f; y < bounds * 2.0f/3.0f; y++) {
+            for (int z = bounds/3.0f; z < bounds * 2.0f/3.0f; z++) {
+                bool alive = spawnRoll(rng);
+                size_t oneIdx = threeToOne(x, y, z, bounds);
+                cells[oneIdx].randomizeState(alive, state);
+                stats.aliveCells += alive;
+                stats.deadCells -= alive;
+                stats.hash += cellHash(oneIdx, cells[oneIdx].getHp());
+            }
+        }
+    }
+    return stats;
+}
+
+
+CellVector createCells(const SimulationConfig &config) {
+    const int bounds = config.cellBounds;
+    // The vector isn't written to when it is made (see FirstTouchAllocator), so with firstTouch every worker
+    // constructs its own x slab and those pages end up on the worker's NUMA node
+    CellVector cells((size_t)bounds * bounds * bounds);
+    auto construct = [&](int start, int end) {
+        for (int x = start; x < end; x++) {
+            for (int y = 0; y < bounds; y++) {
+                for (int z = 0; z < bounds; z++) {
+                    ::new ((void *)&cells[threeToOne(x, y, z, bounds)]) Cell({ x, y, z });
+                }
+            }
+        }
+    };
+    forEachSlab(config.firstTouch ? std::max<size_t>(config.threads, 1) : 1, bounds, config.pinThreads, construct);
+    return cells;
+}
+
+
+TickStats countGeneration(const vector<int> &hp, int state) {
+    TickStats stats = { 0, 0, 0, 0 };
+    for (size_t i = 0; i < hp.size(); i++) {
+        stats.aliveCells += hp[i] == state;
+        stats.deadCells += hp[i] < 0;
+        stats.hash += cellHash(i, hp[i]);
+    }
+    stats.dyingCells = hp.size() - stats.aliveCells - stats.deadCells;
+    return stats;
+}
+
+
+Simulation::Simulation(const SimulationConfig &config) : config(config) {
+    if (config.rules.radius > config.cellBounds) throw std::out_of_range("the neighborhood reaches further than cellBounds");
+    cells = createCells(config);
+    stats.deadCells = cells.size();
+    restartCycles();
+}
+
+Simulation::Simulation(const Simulation &other) : Simulation() {
+    *this = other;
+}
+
+Simulation &Simulation::operator=(const Simulation &other) {
+    if (this == &other) return *this;
+    config = other.config;
+    if (cells.size() != other.cells.size()) cells = createCells(config);
+    cells = other.cells; // element by element, into the memory it already has
+    stats = other.stats;
+    ticks = other.ticks;
+    cycles = other.cycles;
+    playback = other.playback;
+    return *this;
+}
+
+void Simulation::restartCycles() {
+    cycles.reset();
+    cycles.add(stats.hash, ticks);
+    playback.reset();
+}
+
+TickStats Simulation::randomize(std::mt19937 &rng) {
+    stats = randomizeCells(cells, config.cellBounds, config.rules.state, config.aliveChanceOnSpawn, rng);
+    ticks = 0;
+    restartCycles();
+    return stats;
+}
+
+void Simulation::setGeneration(const vector<int> &hp, const TickStats &hpStats, int hpTicks) {
+    for (size_t i = 0; i < cells.size(); i++) cells[i].setHp(hp[i]);
+    stats = hpStats;
+    ticks = hpTicks;
+    restartCycles();
+}
+
+void Simulation::setRules(const RuleSet &rules) {
+    if (rules.radius > config.cellBounds) throw std::out_of_range("the neighborhood reaches further than cellBounds");
+    config.rules = rules;
+    restartCycles();
+}
+
+int Simulation::tick(int batch) {
+    if (playback.isReady()) {
+        stats = playback.play(cells);
+        ticks++;
+        cycles.add(stats.hash, ticks);
+        return 1;
+    }
+    // Batches stop once a cycle is found, every tick of it has to be saved
+    int generations = cycles.getPeriod() == 0 ? std::max(batch, 1) : 1;
+    stats = updateCellsBatch(cells, config, generations, stats.hash);
+    ticks += generations;
+    playback.record(cells, stats, cycles.add(stats.hash, ticks));
+    return generations;
+}
+
+TickStats Simulation::update(int generations, vector<double> *threadBusy) {
+    stats = updateCellsBatch(cells, config, generations, stats.hash, threadBusy);
+    ticks += generations;
+    return stats;
+}
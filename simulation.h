@@ -0,0 +1,216 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "rules.h"
+
+using std::string;
+using std::vector;
+
+
+#define CYCLE_HISTORY 256
+#define DIRECT_KERNEL_MAX_OFFSETS 32
+#define TILE_SIZE 16
+#define PLAYBACK_MAX_BYTES (512 * 1024 * 1024)
+
+
+enum SchedulerMode {
+    STATIC,
+    STEALING
+};
+
+
+struct TickStats {
+    size_t aliveCells;
+    size_t dyingCells;
+    size_t deadCells;
+    uint64_t hash;
+};
+
+struct SimulationConfig {
+    // Everything a Simulation needs to know about how it ticks (from options.json, see loadOptions)
+    RuleSet rules;
+    int cellBounds = 0;
+    float aliveChanceOnSpawn = 0;
+    size_t threads = 1;
+    SchedulerMode scheduler = STEALING;
+    bool pinThreads = false;
+    bool firstTouch = true;
+    int ticksPerBatch = 1;
+    // Turned off by --bench to compare against the generic kernels
+    bool specializedKernels = true;
+};
+
+
+string textFromEnum(SchedulerMode sm);
+SchedulerMode schedulerFromText(const string &text);
+
+uint64_t cellHash(size_t index, int hp);
+
+inline size_t threeToOne(int x, int y, int z, int bounds) {
+    return x * bounds * bounds + y * bounds  + z;
+}
+
+int ghostSource(int i, int bounds, BoundaryMode boundary);
+
+
+class CycleDetector {
+private:
+    // Ring of the last CYCLE_HISTORY generation hashes
+    uint64_t hashes[CYCLE_HISTORY];
+    int ticks[CYCLE_HISTORY];
+    size_t count = 0;
+    int period = 0;
+    int cycleStart = 0;
+public:
+    void reset() {
+        count = 0;
+        period = 0;
+    }
+    // Returns the period of the cycle (1 = steady state) or 0 if no generation has repeated
+    int add(uint64_t hash, int tick);
+    int getPeriod() const { return period; }
+    int getCycleStart() const { return cycleStart; }
+};
+
+
+class Cell {
+private:
+    Vector3Int index;
+    int hp = -1;
+    size_t neighbors = 0;
+
+public:
+    Cell(Vector3Int index) : index(index) {}
+
+    const Vector3Int &getIndex() const { return index; }
+    void setNeighbors(size_t neighbors) { this->neighbors = neighbors; }
+    int getHp() const { return hp; }
+    void setHp(int hp) { this->hp = hp; }
+    bool getAlive(int state) const { return hp == state; }
+    void reset() {
+        hp = -1;
+        neighbors = 0;
+    }
+    void randomizeState(bool alive, int state) {
+        hp = alive * (state + 1) - 1;
+    }
+    void sync(const RuleSet &rules) {
+        hp = rules.transitions[(hp + 1) * rules.survival.size() + neighbors];
+    }
+    void jsonStateUpdate(int oldState, int newState) {
+        hp =
+            (hp < 0) * -1 + // stay dead
+            (hp >= 0) * (hp * (float)newState/oldState); // scale hp
+    }
+};
+
+template <typename T>
+struct FirstTouchAllocator : std::allocator<T> {
+    // Same as std::allocator, except that default constructing an element does nothing, so resizing doesn't
+    // write to (touch) the new memory. The OS puts a page on the NUMA node of the thread that touches it first,
+    // so this lets each worker be the first to touch its own slab (see createCells and fillAliveMask)
+    template <typename U>
+    struct rebind { typedef FirstTouchAllocator<U> other; };
+
+    FirstTouchAllocator() = default;
+    template <typename U>
+    FirstTouchAllocator(const FirstTouchAllocator<U> &) {}
+
+    template <typename U>
+    void construct(U *) {}
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&...args) { ::new ((void *)p) U(std::forward<Args>(args)...); }
+};
+
+using CellVector = vector<Cell, FirstTouchAllocator<Cell>>;
+
+
+class CyclePlayback {
+private:
+    // Once a cycle of period k is detected, the next k generations are saved as they are computed
+    // and after that every tick is served from them instead of updating the cells
+    vector<vector<int>> generations;
+    vector<TickStats> generationStats;
+    int period = 0;
+    size_t next = 0;
+public:
+    void reset() {
+        generations.clear();
+        generationStats.clear();
+        period = 0;
+        next = 0;
+    }
+    bool isReady() const { return period > 0 && generations.size() == (size_t)period; }
+    int getPeriod() const { return period; }
+    // Called after every computed tick with the period from the CycleDetector
+    void record(const CellVector &cells, const TickStats &stats, int detectedPeriod);
+    // Puts the next generation of the cycle into cells
+    TickStats play(CellVector &cells);
+};
+
+
+uint64_t hashCells(const CellVector &cells);
+// The counts and hash of a generation given as every cell's hp
+TickStats countGeneration(const vector<int> &hp, int state);
+
+// The engines: both read and write cells in place, and take the hash of the generation they start from
+TickStats updateCells(CellVector &cells, const SimulationConfig &config, uint64_t previousHash, vector<double> *threadBusy = nullptr);
+bool canBatch(const RuleSet &rules);
+TickStats updateCellsBatch(CellVector &cells, const SimulationConfig &config, int generations, uint64_t previousHash, vector<double> *threadBusy = nullptr);
+
+// Runs work(thread, start, end) on each of the update threads at the same time, with the same x slabs [start, end)
+// as the ticks (so every thread reads the cells it first touched)
+void forEachUpdateThread(const SimulationConfig &config, const std::function<void(size_t, int, int)> &work);
+
+TickStats randomizeCells(CellVector &cells, int bounds, int state, float aliveChance, std::mt19937 &rng);
+CellVector createCells(const SimulationConfig &config);
+
+
+class Simulation {
+    // A grid, its rules and where it is in time: everything a tick reads or writes, so any number of them
+    // can be run side by side. It isn't thread safe, it belongs to whichever thread ticks it
+    // (the viewer hands a copy to the simulation thread, see TickProducer)
+private:
+    SimulationConfig config;
+    CellVector cells;
+    TickStats stats = { 0, 0, 0, 0 };
+    int ticks = 0;
+    CycleDetector cycles;
+    CyclePlayback playback;
+
+    void restartCycles();
+
+public:
+    Simulation() = default;
+    // Every cell dead (throws std::out_of_range when the neighborhood doesn't fit in cellBounds)
+    Simulation(const SimulationConfig &config);
+    // Copies reuse the cells' memory when the sizes match, so it stays where the workers first touched it
+    Simulation(const Simulation &other);
+    Simulation &operator=(const Simulation &other);
+    Simulation(Simulation &&) = default;
+    Simulation &operator=(Simulation &&) = default;
+
+    const SimulationConfig &getConfig() const { return config; }
+    const CellVector &getCells() const { return cells; }
+    const TickStats &getStats() const { return stats; }
+    int getTicks() const { return ticks; }
+    int getPeriod() const { return cycles.getPeriod(); }
+    int getCycleStart() const { return cycles.getCycleStart(); }
+    bool isReplaying() const { return playback.isReady(); }
+
+    // These start over at a new generation (forgetting any cycle)
+    TickStats randomize(std::mt19937 &rng);
+    void setGeneration(const vector<int> &hp, const TickStats &hpStats, int hpTicks);
+    // Keeps the cells, so a new rule starts from the old rule's generation (randomize() after for a fresh start)
+    void setRules(const RuleSet &rules);
+
+    // Moves forward batch ticks (1 once a cycle is found, while it is saved or replayed), returns how many it did
+    int tick(int batch);
+    // Just the update, no cycle detection (for the benchmarks and self tests)
+    TickStats update(int generations, vector<double> *threadBusy = nullptr);
+};